@@ -0,0 +1,364 @@
+/**
+ * @file async.c
+ * @brief asynchronous sector I/O engine (io_uring, with a synchronous fallback)
+ *
+ * The io_uring rings are set up with the raw system calls, so that no
+ * library is needed. Build with -DU6FS_NO_IO_URING to leave io_uring out.
+ *
+ * @date spring 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "async.h"
+#include "sector.h"
+#include "error.h"
+
+#if defined(__linux__) && !defined(U6FS_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ASYNC_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef ASYNC_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>    // mmap()
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter
+#include <sys/uio.h>     // struct iovec
+#include <unistd.h>      // syscall(), close()
+#endif
+
+#define NO_SLOT ((int32_t) -1)
+
+#ifdef ASYNC_HAVE_IO_URING
+
+struct async_ring {
+    int fd;                     // io_uring file descriptor
+    unsigned *sq_tail;          // submission queue (shared with the kernel)
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;          // completion queue (shared with the kernel)
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;               // the mappings, and their sizes
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    struct iovec *iov;          // one per request slot
+};
+
+static void async_ring_free(struct async_ring *r)
+{
+    if (r == NULL) return;
+    if (r->sqes != NULL) munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr != NULL) munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0) close(r->fd);
+    free(r->iov);
+    free(r);
+}
+
+#define RING_FIELD(type, base, offset) ((type *) (void *) ((uint8_t *) (base) + (offset)))
+
+/**
+ * @brief set up the submission and completion rings
+ * @return the rings, or NULL if io_uring is not usable
+ */
+static struct async_ring *async_ring_setup(unsigned depth)
+{
+    struct async_ring *r = calloc(1, sizeof(struct async_ring));
+    if (r == NULL) return NULL;
+    r->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int) syscall(__NR_io_uring_setup, depth, &p);
+    r->iov = calloc(depth, sizeof(struct iovec));
+    if (r->fd < 0 || r->iov == NULL) {
+        async_ring_free(r);
+        return NULL;
+    }
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        async_ring_free(r);
+        return NULL;
+    }
+    if (single) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            async_ring_free(r);
+            return NULL;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        async_ring_free(r);
+        return NULL;
+    }
+
+    r->sq_tail = RING_FIELD(unsigned, r->sq_ptr, p.sq_off.tail);
+    r->sq_mask = RING_FIELD(unsigned, r->sq_ptr, p.sq_off.ring_mask);
+    r->sq_array = RING_FIELD(unsigned, r->sq_ptr, p.sq_off.array);
+    r->cq_head = RING_FIELD(unsigned, r->cq_ptr, p.cq_off.head);
+    r->cq_tail = RING_FIELD(unsigned, r->cq_ptr, p.cq_off.tail);
+    r->cq_mask = RING_FIELD(unsigned, r->cq_ptr, p.cq_off.ring_mask);
+    r->cqes = RING_FIELD(struct io_uring_cqe, r->cq_ptr, p.cq_off.cqes);
+    return r;
+}
+
+/**
+ * @brief put the (remaining part of the) transfer of a request slot into the
+ *        submission queue; it reaches the kernel with the next async_submit()
+ */
+static void async_ring_push(struct async_engine *e, int32_t slot)
+{
+    struct async_ring *r = e->ring;
+    struct async_request *req = &e->reqs[slot];
+    const unsigned tail = *r->sq_tail;
+    const unsigned idx = tail & *r->sq_mask;
+
+    r->iov[slot].iov_base = req->data + req->done;
+    r->iov[slot].iov_len = SECTOR_SIZE - req->done;
+
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = e->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &r->iov[slot];
+    sqe->len = 1;
+    sqe->off = (uint64_t) req->sector * SECTOR_SIZE + req->done;
+    sqe->user_data = (uint64_t) (uint32_t) slot;
+    r->sq_array[idx] = idx;
+
+    // the kernel must see the entry before the new tail
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++e->queued;
+}
+
+static int async_ring_enter(struct async_ring *r, unsigned to_submit, unsigned min_complete)
+{
+    const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return (int) ret;
+}
+
+#else
+
+struct async_ring {
+    int unused;
+};
+
+static void async_ring_free(struct async_ring *r)
+{
+    free(r);
+}
+
+#endif /* ASYNC_HAVE_IO_URING */
+
+struct async_engine *async_alloc(int fd, unsigned depth, int flags)
+{
+    if (fd < 0 || depth == 0) {
+        return NULL;
+    }
+
+    struct async_engine *e = calloc(1, sizeof(struct async_engine));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->fd = fd;
+    e->depth = depth;
+    e->reqs = calloc(depth, sizeof(struct async_request));
+    if (e->reqs == NULL) {
+        free(e);
+        return NULL;
+    }
+    for (unsigned i = 0; i < depth; ++i) {
+        e->reqs[i].next = i + 1 < depth ? (int32_t) (i + 1) : NO_SLOT;
+    }
+    e->free = 0;
+
+#ifdef ASYNC_HAVE_IO_URING
+    if (!(flags & ASYNC_SYNC)) {
+        // NULL (e.g. ENOSYS or EPERM): fall back to synchronous transfers
+        e->ring = async_ring_setup(depth);
+    }
+#else
+    (void) flags;
+#endif
+    return e;
+}
+
+int async_is_async(const struct async_engine *e)
+{
+    return e != NULL && e->ring != NULL;
+}
+
+/**
+ * @brief account for the end of a transfer: resubmit what is left of a
+ *        partial one, otherwise call the callback and release the slot
+ *        (the first error, of the transfer or of a callback, is kept in e->err)
+ * @param res the number of bytes transferred, or <0 on error
+ */
+static void async_complete(struct async_engine *e, int32_t slot, int res)
+{
+    struct async_request *req = &e->reqs[slot];
+#ifdef ASYNC_HAVE_IO_URING
+    if (res > 0 && req->done + (size_t) res < SECTOR_SIZE) {
+        req->done += (size_t) res;
+        async_ring_push(e, slot);
+        return;
+    }
+#endif
+    int err = (res > 0 && req->done + (size_t) res == SECTOR_SIZE) ? ERR_NONE : ERR_IO;
+
+    // released after the callback: a read may still be in req->buf
+    if (req->cb != NULL) {
+        const int cb_err = req->cb(req->arg, req->sector, req->data, err);
+        if (err == ERR_NONE) err = cb_err;
+    }
+    if (e->err == ERR_NONE) e->err = err;
+    req->next = e->free;
+    e->free = slot;
+    --e->inflight;
+}
+
+#ifdef ASYNC_HAVE_IO_URING
+/**
+ * @brief process the available completions, waiting for at least one if wait is set
+ * @return 0 on success; ERR_IO if the ring fails
+ */
+static int async_reap(struct async_engine *e, int wait)
+{
+    struct async_ring *r = e->ring;
+    for (;;) {
+        unsigned head = *r->cq_head;
+        const unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (!wait) return ERR_NONE;
+            if (async_ring_enter(r, 0, 1) < 0) return ERR_IO;
+            continue;
+        }
+        while (head != tail) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            const int32_t slot = (int32_t) cqe->user_data;
+            const int res = cqe->res;
+            ++head;
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            async_complete(e, slot, res);
+        }
+        wait = 0;
+    }
+}
+#endif
+
+/**
+ * @brief queue a transfer (or, without io_uring, perform it at once)
+ * @return 0 on success; <0 if the request could not be queued
+ */
+static int async_queue(struct async_engine *e, uint32_t sector, uint8_t *data, int write,
+                       async_callback cb, void *arg)
+{
+    M_REQUIRE_NON_NULL(e);
+#ifdef ASYNC_HAVE_IO_URING
+    // make room: wait for the oldest requests
+    while (e->ring != NULL && e->free == NO_SLOT && e->inflight > 0) {
+        int err = async_submit(e);
+        if (err == ERR_NONE) err = async_reap(e, 1);
+        if (err != ERR_NONE) return err;
+    }
+#endif
+    if (e->free == NO_SLOT) return ERR_IO; // every slot is held by a running callback
+
+    const int32_t slot = e->free;
+    struct async_request *req = &e->reqs[slot];
+    e->free = req->next;
+    req->sector = sector;
+    req->data = data != NULL ? data : req->buf;
+    req->done = 0;
+    req->write = write;
+    req->cb = cb;
+    req->arg = arg;
+    ++e->inflight;
+
+#ifdef ASYNC_HAVE_IO_URING
+    if (e->ring != NULL) {
+        async_ring_push(e, slot);
+        return ERR_NONE;
+    }
+#endif
+    const int res = write ? sector_pwrite(e->fd, sector, req->data) : sector_pread(e->fd, sector, req->data);
+    async_complete(e, slot, res == ERR_NONE ? SECTOR_SIZE : -1);
+    return ERR_NONE;
+}
+
+int async_read(struct async_engine *e, uint32_t sector, void *data, async_callback cb, void *arg)
+{
+    return async_queue(e, sector, data, 0, cb, arg);
+}
+
+int async_write(struct async_engine *e, uint32_t sector, const void *data, async_callback cb, void *arg)
+{
+    M_REQUIRE_NON_NULL(data);
+    // the data is only read from, even though requests hold a writable pointer
+    return async_queue(e, sector, (uint8_t *) (uintptr_t) data, 1, cb, arg);
+}
+
+int async_submit(struct async_engine *e)
+{
+    M_REQUIRE_NON_NULL(e);
+#ifdef ASYNC_HAVE_IO_URING
+    while (e->ring != NULL && e->queued > 0) {
+        const int n = async_ring_enter(e->ring, e->queued, 0);
+        if (n <= 0) return ERR_IO;
+        e->queued -= (unsigned) n;
+    }
+#endif
+    return ERR_NONE;
+}
+
+int async_wait(struct async_engine *e)
+{
+    M_REQUIRE_NON_NULL(e);
+#ifdef ASYNC_HAVE_IO_URING
+    while (e->ring != NULL && e->inflight > 0) {
+        int err = async_submit(e);
+        if (err == ERR_NONE) err = async_reap(e, 1);
+        if (err != ERR_NONE) return err;
+    }
+#endif
+    const int err = e->err;
+    e->err = ERR_NONE;
+    return err;
+}
+
+void async_free(struct async_engine *e)
+{
+    if (e != NULL) {
+        if (e->inflight > 0) async_wait(e);
+        async_ring_free(e->ring);
+        free(e->reqs);
+        free(e);
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+/**
+ * @file async.h
+ * @brief asynchronous sector I/O engine (io_uring, with a synchronous fallback)
+ *
+ * Sector reads and writes are queued with async_read()/async_write(), handed
+ * to the kernel together by async_submit(), and completed by async_wait(),
+ * which calls the completion callback of each request.
+ * Up to `depth` requests are kept in flight; queuing one more first waits
+ * for the oldest ones to complete.
+ *
+ * Errors of the transfers and of the callbacks are reported by async_wait().
+ *
+ * When io_uring is not available (old kernel, seccomp filter, non-Linux
+ * build, or ASYNC_SYNC requested), the same API performs each request with
+ * a blocking positional read/write as soon as it is queued, and calls its
+ * callback at once. Callbacks must not queue new requests.
+ *
+ * @date spring 2023
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASYNC_DEFAULT_DEPTH 64 /* requests in flight */
+
+#define ASYNC_SYNC 0x1 /* do not even try io_uring */
+
+/**
+ * @brief completion callback of a request
+ * @param arg the argument given when queuing the request
+ * @param sector the sector of the request
+ * @param data the sector content (read into it, or written from it)
+ * @param err 0 if the transfer succeeded, ERR_IO otherwise
+ * @return 0 on success; <0 to make async_wait() report this error
+ */
+typedef int (*async_callback)(void *arg, uint32_t sector, void *data, int err);
+
+struct async_request {
+    uint32_t sector;            // the location (in sector units) within the virtual disk
+    uint8_t *data;              // the 512-bytes of memory to transfer
+    size_t done;                // bytes already transferred (partial completions)
+    int write;                  // 0: read, 1: write
+    async_callback cb;          // called once the transfer is over (may be NULL)
+    void *arg;                  // argument of cb
+    int32_t next;               // next free request slot (-1: end of list)
+    uint8_t buf[SECTOR_SIZE];   // holds reads queued without a buffer
+};
+
+struct async_ring;              // io_uring mappings, private to async.c
+
+struct async_engine {
+    int fd;                     // file descriptor of the virtual disk
+    unsigned depth;             // maximum number of requests in flight
+    unsigned queued;            // requests queued but not yet submitted
+    unsigned inflight;          // requests queued or submitted, not yet completed
+    int32_t free;               // first free request slot (-1: none)
+    int err;                    // first error not reported by async_wait() yet
+    struct async_request *reqs; // one slot per request in flight
+    struct async_ring *ring;    // NULL: synchronous fallback
+};
+
+/**
+ * @brief allocate an I/O engine on top of the given virtual disk
+ * @param fd file descriptor of the virtual disk
+ * @param depth the maximum number of requests in flight (at least 1)
+ * @param flags ASYNC_SYNC to force the synchronous fallback, 0 otherwise
+ * @return a pointer to the newly created engine or NULL on failure
+ */
+struct async_engine *async_alloc(int fd, unsigned depth, int flags);
+
+/**
+ * @brief tell whether the engine really uses io_uring
+ * @param e the engine
+ * @return 1 with io_uring, 0 with the synchronous fallback
+ */
+int async_is_async(const struct async_engine *e);
+
+/**
+ * @brief queue the read of one sector
+ * @param e the engine
+ * @param sector the location (in sector units) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT), or NULL to read into a
+ *        buffer of the engine, only valid during the callback
+ * @param cb the completion callback (may be NULL)
+ * @param arg the argument of cb
+ * @return 0 on success; <0 if the request could not be queued
+ */
+int async_read(struct async_engine *e, uint32_t sector, void *data, async_callback cb, void *arg);
+
+/**
+ * @brief queue the write of one sector; data must stay valid until the callback
+ * @param e the engine
+ * @param sector the location (in sector units) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @param cb the completion callback (may be NULL)
+ * @param arg the argument of cb
+ * @return 0 on success; <0 if the request could not be queued
+ */
+int async_write(struct async_engine *e, uint32_t sector, const void *data, async_callback cb, void *arg);
+
+/**
+ * @brief hand all queued requests to the kernel, without waiting for them
+ * @param e the engine
+ * @return 0 on success; <0 on error
+ */
+int async_submit(struct async_engine *e);
+
+/**
+ * @brief submit the queued requests and wait until every request is complete,
+ *        calling their callbacks
+ * @param e the engine
+ * @return 0 on success; the first error (of a transfer or a callback) since
+ *         the previous call otherwise
+ */
+int async_wait(struct async_engine *e);
+
+/**
+ * @brief wait for the requests in flight, then release the engine
+ * @param e the engine
+ */
+void async_free(struct async_engine *e);
+
+#ifdef __cplusplus
+}
+#endif
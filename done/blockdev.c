@@ -0,0 +1,355 @@
+/**
+ * @file blockdev.c
+ * @brief block devices: file, mmap and RAM backends
+ *
+ * @date spring 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>    // posix_fadvise()
+#include <sys/mman.h> // mmap(), madvise()
+#include <sys/stat.h> // fstat()
+#include <unistd.h>   // ftruncate(), sysconf()
+#include "blockdev.h"
+#include "sector.h"
+#include "error.h"
+
+/* ====================================================================== *
+ * file backend: positional I/O on the descriptor                         *
+ * ====================================================================== */
+
+static int file_read(struct blockdev *dev, uint32_t first, uint32_t count, void *data)
+{
+    return sector_pread_range(dev->fd, first, count, data);
+}
+
+static int file_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data)
+{
+    return sector_pwrite_range(dev->fd, first, count, data);
+}
+
+static int file_readv(struct blockdev *dev, const uint32_t *sectors, void *const *bufs, size_t n)
+{
+    return sector_preadv(dev->fd, sectors, bufs, n);
+}
+
+static int file_writev(struct blockdev *dev, const uint32_t *sectors, const void *const *bufs, size_t n)
+{
+    return sector_pwritev(dev->fd, sectors, bufs, n);
+}
+
+/**
+ * @brief call advise(dev, first, count) once per run of consecutive sectors
+ */
+static void prefetch_runs(struct blockdev *dev, const uint32_t *sectors, size_t n,
+                          void (*advise)(struct blockdev *dev, uint32_t first, uint32_t count))
+{
+    size_t i = 0;
+    while (i < n) {
+        size_t len = 1;
+        while (i + len < n && sectors[i + len] == sectors[i] + len) ++len;
+        advise(dev, sectors[i], (uint32_t) len);
+        i += len;
+    }
+}
+
+static void file_advise(struct blockdev *dev, uint32_t first, uint32_t count)
+{
+    (void) posix_fadvise(dev->fd, (off_t) first * SECTOR_SIZE, (off_t) count * SECTOR_SIZE,
+                         POSIX_FADV_WILLNEED);
+}
+
+static void file_prefetch(struct blockdev *dev, const uint32_t *sectors, size_t n)
+{
+    prefetch_runs(dev, sectors, n, file_advise);
+}
+
+static int file_flush(struct blockdev *dev)
+{
+    // every write already went to the kernel with pwrite()
+    (void) dev;
+    return ERR_NONE;
+}
+
+static uint32_t file_size(const struct blockdev *dev)
+{
+    struct stat st;
+    if (fstat(dev->fd, &st) != 0) return 0;
+    return (uint32_t) ((size_t) st.st_size / SECTOR_SIZE);
+}
+
+static void file_close(struct blockdev *dev)
+{
+    free(dev);
+}
+
+static const struct blockdev_ops file_ops = {
+    .read = file_read,
+    .write = file_write,
+    .readv = file_readv,
+    .writev = file_writev,
+    .prefetch = file_prefetch,
+    .flush = file_flush,
+    .size = file_size,
+    .close = file_close,
+};
+
+struct blockdev *blockdev_file(int fd)
+{
+    if (fd < 0) return NULL;
+    struct blockdev *dev = calloc(1, sizeof(struct blockdev));
+    if (dev == NULL) return NULL;
+    dev->ops = &file_ops;
+    dev->fd = fd;
+    return dev;
+}
+
+/* ====================================================================== *
+ * memory backends: mmap and ram                                          *
+ * ====================================================================== */
+
+struct blockdev_mem {
+    struct blockdev dev;        // must be first
+    int backing;                // the image file (ram: -1 if none)
+    int rdonly;                 // mmap: PROT_READ mapping; ram: never saved back
+    uint32_t dirty_first;       // ram: range of the sectors written since the last flush
+    uint32_t dirty_end;         //      (dirty_first == dirty_end: none)
+};
+
+static uint32_t mem_size(const struct blockdev *dev)
+{
+    return (uint32_t) (dev->mem_size / SECTOR_SIZE);
+}
+
+static int mem_read(struct blockdev *dev, uint32_t first, uint32_t count, void *data)
+{
+    if ((size_t) first + count > mem_size(dev)) return ERR_IO;
+    memcpy(data, dev->mem + (size_t) first * SECTOR_SIZE, (size_t) count * SECTOR_SIZE);
+    return ERR_NONE;
+}
+
+static int mem_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data)
+{
+    if ((size_t) first + count > mem_size(dev)) return ERR_IO;
+    memcpy(dev->mem + (size_t) first * SECTOR_SIZE, data, (size_t) count * SECTOR_SIZE);
+    return ERR_NONE;
+}
+
+static int mmap_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data)
+{
+    // writing to a PROT_READ mapping would crash
+    if (((struct blockdev_mem *) dev)->rdonly) return ERR_IO;
+    return mem_write(dev, first, count, data);
+}
+
+static void mmap_advise(struct blockdev *dev, uint32_t first, uint32_t count)
+{
+    // madvise() wants a page-aligned address
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = (size_t) first * SECTOR_SIZE;
+    size_t end = start + (size_t) count * SECTOR_SIZE;
+    if (end > dev->mem_size) end = dev->mem_size;
+    if (start >= end) return;
+    start -= start % page;
+    (void) madvise(dev->mem + start, end - start, MADV_WILLNEED);
+}
+
+static void mmap_prefetch(struct blockdev *dev, const uint32_t *sectors, size_t n)
+{
+    prefetch_runs(dev, sectors, n, mmap_advise);
+}
+
+static int mmap_flush(struct blockdev *dev)
+{
+    if (((struct blockdev_mem *) dev)->rdonly) return ERR_NONE;
+    return msync(dev->mem, dev->mem_size, MS_SYNC) == 0 ? ERR_NONE : ERR_IO;
+}
+
+static void mmap_close(struct blockdev *dev)
+{
+    munmap(dev->mem, dev->mem_size);
+    free(dev);
+}
+
+static const struct blockdev_ops mmap_ops = {
+    .read = mem_read,
+    .write = mmap_write,
+    .prefetch = mmap_prefetch,
+    .flush = mmap_flush,
+    .size = mem_size,
+    .close = mmap_close,
+};
+
+static int ram_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data)
+{
+    int err = mem_write(dev, first, count, data);
+    if (err != ERR_NONE || count == 0) return err;
+
+    struct blockdev_mem *m = (struct blockdev_mem *) dev;
+    if (m->dirty_first == m->dirty_end) {
+        m->dirty_first = first;
+        m->dirty_end = first + count;
+    } else {
+        if (first < m->dirty_first) m->dirty_first = first;
+        if (first + count > m->dirty_end) m->dirty_end = first + count;
+    }
+    return ERR_NONE;
+}
+
+static int ram_flush(struct blockdev *dev)
+{
+    struct blockdev_mem *m = (struct blockdev_mem *) dev;
+    if (m->backing < 0 || m->rdonly || m->dirty_first == m->dirty_end) return ERR_NONE;
+
+    // one write for everything modified since the last flush
+    int err = sector_pwrite_range(m->backing, m->dirty_first, m->dirty_end - m->dirty_first,
+                                  dev->mem + (size_t) m->dirty_first * SECTOR_SIZE);
+    if (err == ERR_NONE) m->dirty_first = m->dirty_end = 0;
+    return err;
+}
+
+static void ram_close(struct blockdev *dev)
+{
+    free(dev->mem);
+    free(dev);
+}
+
+static const struct blockdev_ops ram_ops = {
+    .read = mem_read,
+    .write = ram_write,
+    .flush = ram_flush,
+    .size = mem_size,
+    .close = ram_close,
+};
+
+struct blockdev *blockdev_mmap(int fd, uint32_t nsectors, int rdonly)
+{
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+
+    // images may be shorter than the volume: a writable mapping must cover all of it
+    const off_t volume_size = (off_t) nsectors * SECTOR_SIZE;
+    if (!rdonly && st.st_size < volume_size) {
+        if (ftruncate(fd, volume_size) != 0) return NULL;
+        st.st_size = volume_size;
+    }
+    if (st.st_size < SECTOR_SIZE) return NULL;
+
+    struct blockdev_mem *m = calloc(1, sizeof(struct blockdev_mem));
+    if (m == NULL) return NULL;
+    const int prot = rdonly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *map = mmap(NULL, (size_t) st.st_size, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        free(m);
+        return NULL;
+    }
+
+    m->dev.ops = &mmap_ops;
+    m->dev.fd = -1;
+    m->dev.mem = map;
+    m->dev.mem_size = (size_t) st.st_size;
+    m->backing = fd;
+    m->rdonly = rdonly;
+    return &m->dev;
+}
+
+struct blockdev *blockdev_ram(int fd, uint32_t nsectors, int rdonly)
+{
+    uint32_t loaded = 0;
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) return NULL;
+        loaded = (uint32_t) ((size_t) st.st_size / SECTOR_SIZE);
+    }
+    const uint32_t size = loaded > nsectors ? loaded : nsectors;
+    if (size == 0) return NULL;
+
+    struct blockdev_mem *m = calloc(1, sizeof(struct blockdev_mem));
+    if (m == NULL) return NULL;
+    m->dev.mem = calloc(size, SECTOR_SIZE);
+    if (m->dev.mem == NULL) {
+        free(m);
+        return NULL;
+    }
+    if (loaded > 0 && sector_pread_range(fd, 0, loaded, m->dev.mem) != ERR_NONE) {
+        ram_close(&m->dev);
+        return NULL;
+    }
+
+    m->dev.ops = &ram_ops;
+    m->dev.fd = -1;
+    m->dev.mem_size = (size_t) size * SECTOR_SIZE;
+    m->backing = fd;
+    m->rdonly = rdonly;
+    return &m->dev;
+}
+
+/* ====================================================================== *
+ * generic entry points                                                   *
+ * ====================================================================== */
+
+int blockdev_read(struct blockdev *dev, uint32_t first, uint32_t count, void *data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(data);
+    return dev->ops->read(dev, first, count, data);
+}
+
+int blockdev_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(data);
+    return dev->ops->write(dev, first, count, data);
+}
+
+int blockdev_readv(struct blockdev *dev, const uint32_t *sectors, void *const *bufs, size_t n)
+{
+    M_REQUIRE_NON_NULL(dev);
+    if (n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+    if (dev->ops->readv != NULL) return dev->ops->readv(dev, sectors, bufs, n);
+    for (size_t i = 0; i < n; ++i) {
+        int err = dev->ops->read(dev, sectors[i], 1, bufs[i]);
+        if (err != ERR_NONE) return err;
+    }
+    return ERR_NONE;
+}
+
+int blockdev_writev(struct blockdev *dev, const uint32_t *sectors, const void *const *bufs, size_t n)
+{
+    M_REQUIRE_NON_NULL(dev);
+    if (n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+    if (dev->ops->writev != NULL) return dev->ops->writev(dev, sectors, bufs, n);
+    for (size_t i = 0; i < n; ++i) {
+        int err = dev->ops->write(dev, sectors[i], 1, bufs[i]);
+        if (err != ERR_NONE) return err;
+    }
+    return ERR_NONE;
+}
+
+void blockdev_prefetch(struct blockdev *dev, const uint32_t *sectors, size_t n)
+{
+    if (dev == NULL || sectors == NULL || n == 0 || dev->ops->prefetch == NULL) return;
+    dev->ops->prefetch(dev, sectors, n);
+}
+
+int blockdev_flush(struct blockdev *dev)
+{
+    M_REQUIRE_NON_NULL(dev);
+    return dev->ops->flush(dev);
+}
+
+uint32_t blockdev_size(const struct blockdev *dev)
+{
+    return dev != NULL ? dev->ops->size(dev) : 0;
+}
+
+void blockdev_close(struct blockdev *dev)
+{
+    if (dev != NULL) dev->ops->close(dev);
+}
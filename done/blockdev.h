@@ -0,0 +1,154 @@
+#pragma once
+
+/**
+ * @file blockdev.h
+ * @brief block devices: where the sectors of a mounted filesystem live
+ *
+ * A block device is a small vtable (read, write, flush, size, close) over
+ * sectors. The upper layers (sector cache, inode, filev6, direntv6) only
+ * go through it, so that new backends can be added without touching them.
+ *
+ * Three backends are provided:
+ *  - file: positional I/O on a descriptor of the image;
+ *  - mmap: the image mapped in memory;
+ *  - ram:  the image loaded into (or created in) private memory, and
+ *          optionally saved back to its file on flush.
+ * Memory backends expose their content in `mem`, for zero-copy accesses.
+ *
+ * @date spring 2023
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct blockdev;
+
+struct blockdev_ops {
+    /* read/write count consecutive sectors from/into one buffer */
+    int (*read)(struct blockdev *dev, uint32_t first, uint32_t count, void *data);
+    int (*write)(struct blockdev *dev, uint32_t first, uint32_t count, const void *data);
+    /* scatter lists (optional: NULL means one read/write per sector) */
+    int (*readv)(struct blockdev *dev, const uint32_t *sectors, void *const *bufs, size_t n);
+    int (*writev)(struct blockdev *dev, const uint32_t *sectors, const void *const *bufs, size_t n);
+    /* hint that the sectors will be read soon (optional: NULL means no-op) */
+    void (*prefetch)(struct blockdev *dev, const uint32_t *sectors, size_t n);
+    /* make the writes durable */
+    int (*flush)(struct blockdev *dev);
+    /* size of the device, in sectors */
+    uint32_t (*size)(const struct blockdev *dev);
+    /* release the device (without flushing it) */
+    void (*close)(struct blockdev *dev);
+};
+
+struct blockdev {
+    const struct blockdev_ops *ops;
+    int fd;                     // descriptor for raw positional I/O when the device is a plain file (else -1)
+    uint8_t *mem;               // the whole device, when it is in memory (else NULL)
+    size_t mem_size;            // size of mem, in bytes
+};
+
+/**
+ * @brief create a device doing positional I/O on an open image
+ * @param fd file descriptor of the image (not closed by blockdev_close())
+ * @return the device, or NULL on failure
+ */
+struct blockdev *blockdev_file(int fd);
+
+/**
+ * @brief create a device mapping an open image in memory; read-only
+ *        mappings are PROT_READ, thus shared with every other process
+ *        reading the same image
+ * @param fd file descriptor of the image (not closed by blockdev_close())
+ * @param nsectors size of the volume: writable images shorter than that are extended
+ * @param rdonly non-zero for a read-only mapping
+ * @return the device, or NULL on failure
+ */
+struct blockdev *blockdev_mmap(int fd, uint32_t nsectors, int rdonly);
+
+/**
+ * @brief create a device holding the whole volume in private memory
+ * @param fd file descriptor of the image to load (not closed by
+ *        blockdev_close()), or -1 for a blank (zeroed) device
+ * @param nsectors size of the volume (the image is zero-padded up to it)
+ * @param rdonly non-zero not to save the modified sectors back to fd on flush
+ * @return the device, or NULL on failure
+ */
+struct blockdev *blockdev_ram(int fd, uint32_t nsectors, int rdonly);
+
+/**
+ * @brief read count consecutive sectors into one buffer
+ * @param dev the device
+ * @param first the location (in sector units) of the first sector
+ * @param count the number of sectors
+ * @param data a pointer to count * 512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error (ERR_IO beyond the end of the device)
+ */
+int blockdev_read(struct blockdev *dev, uint32_t first, uint32_t count, void *data);
+
+/**
+ * @brief write count consecutive sectors from one buffer
+ * @param dev the device
+ * @param first the location (in sector units) of the first sector
+ * @param count the number of sectors
+ * @param data a pointer to count * 512 bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int blockdev_write(struct blockdev *dev, uint32_t first, uint32_t count, const void *data);
+
+/**
+ * @brief read a scatter list of sectors
+ * @param dev the device
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int blockdev_readv(struct blockdev *dev, const uint32_t *sectors, void *const *bufs, size_t n);
+
+/**
+ * @brief write a scatter list of sectors
+ * @param dev the device
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int blockdev_writev(struct blockdev *dev, const uint32_t *sectors, const void *const *bufs, size_t n);
+
+/**
+ * @brief tell the device that the given sectors will be read soon, so that
+ *        it can start fetching them (readahead); this is only a hint
+ * @param dev the device (may be NULL)
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param n the number of sectors
+ */
+void blockdev_prefetch(struct blockdev *dev, const uint32_t *sectors, size_t n);
+
+/**
+ * @brief make the writes to the device durable
+ * @param dev the device
+ * @return 0 on success; <0 on error
+ */
+int blockdev_flush(struct blockdev *dev);
+
+/**
+ * @brief give the size of the device
+ * @param dev the device
+ * @return the number of sectors of the device (0 if dev is NULL)
+ */
+uint32_t blockdev_size(const struct blockdev *dev);
+
+/**
+ * @brief release the device, without flushing it
+ * @param dev the device (may be NULL)
+ */
+void blockdev_close(struct blockdev *dev);
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,6 +17,12 @@
 
 #define ROUND_UP(_x, _y) ((((_x)+(_y)-1)/(_y))*(_y))
 
+/* AVX2 skips 4 words per comparison; chosen at run time, off with -DU6FS_NO_AVX2 */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(U6FS_NO_AVX2)
+#include <immintrin.h>
+#define BM_HAVE_AVX2 1
+#endif
+
 struct bmblock_array *bm_alloc(uint64_t min, uint64_t max)
 {
     if (min > max) {//bounds included; size = max - min + 1
@@ -36,10 +42,115 @@ struct bmblock_array *bm_alloc(uint64_t min, uint64_t max)
     bmblock->max = max;
     bmblock->min = min;
     bmblock->cursor = UINT64_C(0);
+    bmblock->hint = UINT64_C(0);
+    bmblock->nfree = max - min + 1;
 
     return bmblock;
 }
 
+/* ====================================================================== *
+ * word-at-a-time search engine                                           *
+ * ====================================================================== */
+
+static uint64_t bm_nbits(const struct bmblock_array *b)
+{
+    return b->max - b->min + 1;
+}
+
+/**
+ * @brief mask of the bits of word i which stand for values (the end of the
+ *        last word is padding)
+ */
+static uint64_t bm_valid_mask(const struct bmblock_array *b, size_t i)
+{
+    const uint64_t tail = bm_nbits(b) % BITS_PER_VECTOR;
+    return (i + 1 == b->length && tail != 0) ? (UINT64_C(1) << tail) - 1 : UINT64_MAX;
+}
+
+#ifdef BM_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t bm_skip_words_avx2(const uint64_t *w, size_t i, size_t n, uint64_t pattern)
+{
+    const __m256i p = _mm256_set1_epi64x((long long) pattern);
+    for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (const void *) (w + i));
+        const int eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, p)));
+        if (eq != 0xF) return i + (size_t) __builtin_ctz((unsigned) ~eq & 0xFu);
+    }
+    while (i < n && w[i] == pattern) ++i;
+    return i;
+}
+#endif
+
+/**
+ * @brief skip the words equal to pattern (all ones: full; zero: empty)
+ * @return the index of the first word of [i, n) different from pattern, n if none
+ */
+static size_t bm_skip_words(const uint64_t *w, size_t i, size_t n, uint64_t pattern)
+{
+#ifdef BM_HAVE_AVX2
+    static int avx2 = -1;
+    if (avx2 < 0) avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    if (avx2 && i < n && n - i >= 8) return bm_skip_words_avx2(w, i, n, pattern);
+#endif
+    while (i < n && w[i] == pattern) ++i;
+    return i;
+}
+
+/**
+ * @brief first unused bit (relative to min) at or after from
+ * @return its index, or bm_nbits(b) if none
+ */
+static uint64_t bm_next_free(const struct bmblock_array *b, uint64_t from)
+{
+    const uint64_t nbits = bm_nbits(b);
+    if (from >= nbits) return nbits;
+    size_t i = (size_t) (from / BITS_PER_VECTOR);
+    uint64_t free = ~b->bm[i] & (UINT64_MAX << (from % BITS_PER_VECTOR));
+    while (free == 0) {
+        i = bm_skip_words(b->bm, i + 1, b->length, UINT64_MAX);
+        if (i >= b->length) return nbits;
+        free = ~b->bm[i];
+    }
+    const uint64_t bit = i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(free);
+    return bit < nbits ? bit : nbits;
+}
+
+/**
+ * @brief first used bit (relative to min) at or after from
+ * @return its index, or bm_nbits(b) if none
+ */
+static uint64_t bm_next_used(const struct bmblock_array *b, uint64_t from)
+{
+    const uint64_t nbits = bm_nbits(b);
+    if (from >= nbits) return nbits;
+    size_t i = (size_t) (from / BITS_PER_VECTOR);
+    uint64_t used = b->bm[i] & (UINT64_MAX << (from % BITS_PER_VECTOR));
+    while (used == 0) {
+        i = bm_skip_words(b->bm, i + 1, b->length, 0);
+        if (i >= b->length) return nbits;
+        used = b->bm[i];
+    }
+    const uint64_t bit = i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(used);
+    return bit < nbits ? bit : nbits;
+}
+
+/**
+ * @brief first run of count unused bits (relative to min) at or after from
+ * @return the index of its first bit, or bm_nbits(b) if none
+ */
+static uint64_t bm_next_run(const struct bmblock_array *b, uint64_t from, uint64_t count)
+{
+    const uint64_t nbits = bm_nbits(b);
+    uint64_t start = bm_next_free(b, from);
+    while (start < nbits && count <= nbits - start) {
+        const uint64_t end = bm_next_used(b, start);
+        if (end - start >= count) return start;
+        start = bm_next_free(b, end);
+    }
+    return nbits;
+}
+
 int bm_get(struct bmblock_array *bmblock_array, uint64_t x)
 {
     if ((x < bmblock_array->min) || (x > bmblock_array->max)) {
@@ -53,39 +164,142 @@ int bm_find_next(struct bmblock_array *bmblock_array)
 {
     M_REQUIRE_NON_NULL(bmblock_array);
 
-    uint64_t cursor = bmblock_array->cursor;
-
-    for (size_t i = 0; i < bmblock_array->length; ++i) {
-        uint64_t new_cursor = (cursor + i) % bmblock_array->length;
-        bmblock_array->cursor = new_cursor;
-        // we check first if the 64 are ones and jump to the next one if this is the case
-        if (bmblock_array->bm[new_cursor] != UINT64_C(-1)) {
-            for (uint64_t j = 0; j < BITS_PER_VECTOR; ++j) {
-                uint64_t bit = new_cursor * BITS_PER_VECTOR + j + bmblock_array->min;
-                if (bm_get(bmblock_array, bit) == 0) {
-                    assert(bit <= bmblock_array->max && bit >= bmblock_array->min);
-                    return (int) bit;
-                }
+    // from the cursor to the end, then from the start to the cursor
+    const size_t start = (size_t) (bmblock_array->cursor % bmblock_array->length);
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t i = pass == 0 ? start : 0;
+        const size_t end = pass == 0 ? bmblock_array->length : start;
+        while ((i = bm_skip_words(bmblock_array->bm, i, end, UINT64_MAX)) < end) {
+            const uint64_t free = ~bmblock_array->bm[i] & bm_valid_mask(bmblock_array, i);
+            if (free != 0) {
+                bmblock_array->cursor = i;
+                uint64_t bit = i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(free) + bmblock_array->min;
+                assert(bit <= bmblock_array->max && bit >= bmblock_array->min);
+                return (int) bit;
             }
+            ++i;
         }
     }
 
+    bmblock_array->cursor = (start + bmblock_array->length - 1) % bmblock_array->length;
     return ERR_BITMAP_FULL;
 }
 
+int bm_alloc_next(struct bmblock_array *bmblock_array)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    return bm_alloc_from(bmblock_array, bmblock_array->min + bmblock_array->hint);
+}
+
+int bm_alloc_from(struct bmblock_array *bmblock_array, uint64_t from)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    if (bmblock_array->nfree == 0) return ERR_BITMAP_FULL;
+
+    const uint64_t nbits = bm_nbits(bmblock_array);
+    const uint64_t rel = from > bmblock_array->min ? from - bmblock_array->min : 0;
+    uint64_t bit = bm_next_free(bmblock_array, rel);
+    if (bit >= nbits) bit = bm_next_free(bmblock_array, 0);
+    if (bit >= nbits) return ERR_BITMAP_FULL;
+
+    bm_set(bmblock_array, bmblock_array->min + bit);
+    bmblock_array->hint = bit + 1;
+    return (int) (bmblock_array->min + bit);
+}
+
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t from, uint64_t count)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    if (count == 0) return ERR_BAD_PARAMETER;
+    if (count > bmblock_array->nfree) return ERR_BITMAP_FULL;
+
+    const uint64_t rel = from > bmblock_array->min ? from - bmblock_array->min : 0;
+    const uint64_t bit = bm_next_run(bmblock_array, rel, count);
+    if (bit >= bm_nbits(bmblock_array)) return ERR_BITMAP_FULL;
+    return (int) (bmblock_array->min + bit);
+}
+
+int bm_alloc_run(struct bmblock_array *bmblock_array, uint64_t count)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    return bm_alloc_run_from(bmblock_array, bmblock_array->min + bmblock_array->hint, count);
+}
+
+int bm_alloc_run_from(struct bmblock_array *bmblock_array, uint64_t from, uint64_t count)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    if (count == 0) return ERR_BAD_PARAMETER;
+    if (count > bmblock_array->nfree) return ERR_BITMAP_FULL;
+
+    // a run crossing the goal is found by the second search
+    const uint64_t nbits = bm_nbits(bmblock_array);
+    const uint64_t rel = from > bmblock_array->min ? from - bmblock_array->min : 0;
+    uint64_t bit = bm_next_run(bmblock_array, rel, count);
+    if (bit >= nbits) bit = bm_next_run(bmblock_array, 0, count);
+    if (bit >= nbits) return ERR_BITMAP_FULL;
+
+    for (uint64_t k = 0; k < count; ++k) {
+        bm_set(bmblock_array, bmblock_array->min + bit + k);
+    }
+    bmblock_array->hint = bit + count;
+    return (int) (bmblock_array->min + bit);
+}
+
+uint64_t bm_count_free(const struct bmblock_array *bmblock_array)
+{
+    return bmblock_array != NULL ? bmblock_array->nfree : 0;
+}
+
+uint64_t bm_count_free_range(const struct bmblock_array *bmblock_array, uint64_t from, uint64_t to)
+{
+    if (bmblock_array == NULL) return 0;
+    if (from < bmblock_array->min) from = bmblock_array->min;
+    if (to > bmblock_array->max) to = bmblock_array->max;
+    if (from > to) return 0;
+
+    const uint64_t first = from - bmblock_array->min, last = to - bmblock_array->min;
+    const size_t wfirst = (size_t) (first / BITS_PER_VECTOR), wlast = (size_t) (last / BITS_PER_VECTOR);
+    uint64_t used = 0;
+    for (size_t i = wfirst; i <= wlast; ++i) {
+        uint64_t word = bmblock_array->bm[i];
+        if (i == wfirst) word &= UINT64_MAX << (first % BITS_PER_VECTOR);
+        if (i == wlast) word &= UINT64_MAX >> (BITS_PER_VECTOR - 1 - last % BITS_PER_VECTOR);
+        used += (uint64_t) __builtin_popcountll(word);
+    }
+    return last - first + 1 - used;
+}
+
+void bm_recount(struct bmblock_array *bmblock_array)
+{
+    if (bmblock_array == NULL) return;
+    uint64_t used = 0;
+    for (size_t i = 0; i < bmblock_array->length; ++i) {
+        used += (uint64_t) __builtin_popcountll(bmblock_array->bm[i] & bm_valid_mask(bmblock_array, i));
+    }
+    bmblock_array->nfree = bm_nbits(bmblock_array) - used;
+}
+
 void bm_set(struct bmblock_array *bmblock_array, uint64_t x)
 {
     if (x <= bmblock_array->max && x >= bmblock_array->min) {
-        bmblock_array->bm[(x - bmblock_array->min) / BITS_PER_VECTOR] |= (UINT64_C(1)
-                << ((x - bmblock_array->min) % BITS_PER_VECTOR));
+        uint64_t *word = &bmblock_array->bm[(x - bmblock_array->min) / BITS_PER_VECTOR];
+        const uint64_t mask = UINT64_C(1) << ((x - bmblock_array->min) % BITS_PER_VECTOR);
+        if (!(*word & mask)) {
+            *word |= mask;
+            --bmblock_array->nfree;
+        }
     }
 }
 
 void bm_clear(struct bmblock_array *bmblock_array, uint64_t x)
 {
     if (x <= bmblock_array->max && x >= bmblock_array->min) {
-        bmblock_array->bm[(x - bmblock_array->min) / BITS_PER_VECTOR] &= ~(UINT64_C(1)
-                << ((x - bmblock_array->min) % BITS_PER_VECTOR));
+        uint64_t *word = &bmblock_array->bm[(x - bmblock_array->min) / BITS_PER_VECTOR];
+        const uint64_t mask = UINT64_C(1) << ((x - bmblock_array->min) % BITS_PER_VECTOR);
+        if (*word & mask) {
+            *word &= ~mask;
+            ++bmblock_array->nfree;
+        }
     }
 }
 
@@ -14,6 +14,8 @@
 
 struct bmblock_array {
     uint64_t cursor;    // the current position of our cursor (used by find_next)
+    uint64_t hint;      // next-fit allocation cursor, relative to min (used by bm_alloc_next/bm_alloc_run)
+    uint64_t nfree;     // number of values whose bit is 0, kept up to date by bm_set/bm_clear
     uint64_t min;       // the minimum value of our struct
     uint64_t max;       // the maximum value of our struct
     size_t length;      // the (byte) length of our array of bits
@@ -60,6 +62,77 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x);
  */
 int bm_find_next(struct bmblock_array *bmblock_array);
 
+/**
+ * @brief find an unused value from the allocation cursor on (next fit,
+ *        wrapping around once), mark it used and move the cursor after it
+ * @param bmblock_array the array we want to allocate from
+ * @return <0 on failure (ERR_BITMAP_FULL), the allocated value otherwise
+ */
+int bm_alloc_next(struct bmblock_array *bmblock_array);
+
+/**
+ * @brief find the first run of count consecutive unused values starting at
+ *        from or after it
+ * @param bmblock_array the array we want to search for place
+ * @param from the first value to consider
+ * @param count the length of the run (at least 1)
+ * @return <0 on failure (ERR_BITMAP_FULL), the first value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t from, uint64_t count);
+
+/**
+ * @brief find an unused value from the given one on (wrapping around once),
+ *        mark it used and move the allocation cursor after it
+ * @param bmblock_array the array we want to allocate from
+ * @param from the value to start from (the goal)
+ * @return <0 on failure (ERR_BITMAP_FULL), the allocated value otherwise
+ */
+int bm_alloc_from(struct bmblock_array *bmblock_array, uint64_t from);
+
+/**
+ * @brief find count consecutive unused values from the given one on
+ *        (wrapping around once), mark them used and move the allocation
+ *        cursor after them
+ * @param bmblock_array the array we want to allocate from
+ * @param from the value to start from (the goal)
+ * @param count the length of the run (at least 1)
+ * @return <0 on failure (ERR_BITMAP_FULL), the first value of the run otherwise
+ */
+int bm_alloc_run_from(struct bmblock_array *bmblock_array, uint64_t from, uint64_t count);
+
+/**
+ * @brief find count consecutive unused values from the allocation cursor on
+ *        (next fit, wrapping around once), mark them used and move the
+ *        cursor after them
+ * @param bmblock_array the array we want to allocate from
+ * @param count the length of the run (at least 1)
+ * @return <0 on failure (ERR_BITMAP_FULL), the first value of the run otherwise
+ */
+int bm_alloc_run(struct bmblock_array *bmblock_array, uint64_t count);
+
+/**
+ * @brief give the number of unused values, in constant time
+ * @param bmblock_array the array
+ * @return the number of values whose bit is 0 (0 if bmblock_array is NULL)
+ */
+uint64_t bm_count_free(const struct bmblock_array *bmblock_array);
+
+/**
+ * @brief count the unused values of [from, to], with popcount
+ * @param bmblock_array the array
+ * @param from the first value (clamped to min)
+ * @param to the last value (clamped to max)
+ * @return the number of values whose bit is 0 (0 if bmblock_array is NULL)
+ */
+uint64_t bm_count_free_range(const struct bmblock_array *bmblock_array, uint64_t from, uint64_t to);
+
+/**
+ * @brief recompute the number of unused values with popcount, after the
+ *        bits were filled without bm_set() (e.g. read from disk)
+ * @param bmblock_array the array
+ */
+void bm_recount(struct bmblock_array *bmblock_array);
+
 /**
  * @brief usefull to see (and debug) content of a bmblock_array
  * @param name the name of the printed block
@@ -0,0 +1,357 @@
+/**
+ * @file cache.c
+ * @brief write-back sector cache with CLOCK eviction
+ *
+ * @date spring 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "cache.h"
+#include "sector.h"
+#include "blockdev.h"
+#include "error.h"
+
+#define NO_SLOT ((int32_t) -1)
+
+static size_t cache_bucket(const struct sector_cache *c, uint32_t sector)
+{
+    return sector & (c->nbuckets - 1);
+}
+
+struct sector_cache *cache_alloc(struct blockdev *dev, size_t size, int write_back)
+{
+    if (dev == NULL || size < SECTOR_SIZE) {
+        return NULL;
+    }
+
+    struct sector_cache *c = calloc(1, sizeof(struct sector_cache));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    c->dev = dev;
+    c->write_back = write_back;
+    c->nslots = size / SECTOR_SIZE;
+    c->nbuckets = 1;
+    while (c->nbuckets < c->nslots) {
+        c->nbuckets <<= 1;
+    }
+
+    c->slots = calloc(c->nslots, sizeof(struct cache_entry));
+    c->buckets = malloc(c->nbuckets * sizeof(int32_t));
+    if (c->slots == NULL || c->buckets == NULL) {
+        cache_free(c);
+        return NULL;
+    }
+    for (size_t i = 0; i < c->nbuckets; ++i) {
+        c->buckets[i] = NO_SLOT;
+    }
+
+    return c;
+}
+
+void cache_free(struct sector_cache *c)
+{
+    if (c != NULL) {
+        free(c->slots);
+        free(c->buckets);
+        free(c);
+    }
+}
+
+/**
+ * @brief find the slot holding the given sector
+ * @return the slot index, or NO_SLOT if the sector is not cached
+ */
+static int32_t cache_lookup(const struct sector_cache *c, uint32_t sector)
+{
+    int32_t i = c->buckets[cache_bucket(c, sector)];
+    while (i != NO_SLOT && c->slots[i].sector != sector) {
+        i = c->slots[i].next;
+    }
+    return i;
+}
+
+static void cache_unlink(struct sector_cache *c, int32_t slot)
+{
+    int32_t *link = &c->buckets[cache_bucket(c, c->slots[slot].sector)];
+    while (*link != slot) {
+        link = &c->slots[*link].next;
+    }
+    *link = c->slots[slot].next;
+}
+
+static int cache_writeback(struct sector_cache *c, struct cache_entry *e)
+{
+    int err = blockdev_write(c->dev, e->sector, 1, e->data);
+    if (err != ERR_NONE) return err;
+    e->dirty = 0;
+    ++c->stats.writebacks;
+    return ERR_NONE;
+}
+
+/**
+ * @brief pick a slot for a new sector (CLOCK: skip referenced slots once),
+ *        writing its previous content back if needed, and bind it to sector
+ * @return the slot index on success; <0 on error
+ */
+static int32_t cache_install(struct sector_cache *c, uint32_t sector)
+{
+    struct cache_entry *e = &c->slots[c->hand];
+    while (e->valid && e->referenced) {
+        e->referenced = 0;
+        c->hand = (c->hand + 1) % c->nslots;
+        e = &c->slots[c->hand];
+    }
+    const int32_t slot = (int32_t) c->hand;
+    c->hand = (c->hand + 1) % c->nslots;
+
+    if (e->valid) {
+        if (e->dirty) {
+            int err = cache_writeback(c, e);
+            if (err != ERR_NONE) return err;
+        }
+        cache_unlink(c, slot);
+        ++c->stats.evictions;
+    }
+
+    const size_t b = cache_bucket(c, sector);
+    e->sector = sector;
+    e->valid = 1;
+    e->dirty = 0;
+    e->referenced = 1;
+    e->next = c->buckets[b];
+    c->buckets[b] = slot;
+    return slot;
+}
+
+int cache_read(struct sector_cache *c, uint32_t sector, void *data)
+{
+    M_REQUIRE_NON_NULL(c);
+    M_REQUIRE_NON_NULL(data);
+
+    int32_t slot = cache_lookup(c, sector);
+    if (slot != NO_SLOT) {
+        ++c->stats.hits;
+        c->slots[slot].referenced = 1;
+        memcpy(data, c->slots[slot].data, SECTOR_SIZE);
+        return ERR_NONE;
+    }
+
+    ++c->stats.misses;
+    int err = blockdev_read(c->dev, sector, 1, data);
+    if (err != ERR_NONE) return err;
+
+    slot = cache_install(c, sector);
+    if (slot < 0) return slot;
+    memcpy(c->slots[slot].data, data, SECTOR_SIZE);
+    return ERR_NONE;
+}
+
+/**
+ * @brief copy a whole sector into the cache, installing it if needed
+ * @param dirty must the copy be written back later?
+ * @return 0 on success; <0 on error
+ */
+static int cache_store(struct sector_cache *c, uint32_t sector, const void *data, int dirty)
+{
+    int32_t slot = cache_lookup(c, sector);
+    if (slot != NO_SLOT) {
+        ++c->stats.hits;
+        c->slots[slot].referenced = 1;
+    } else {
+        // a whole sector is overwritten: no need to read it first
+        slot = cache_install(c, sector);
+        if (slot < 0) return slot;
+    }
+    memcpy(c->slots[slot].data, data, SECTOR_SIZE);
+    c->slots[slot].dirty = (uint8_t) (dirty != 0);
+    return ERR_NONE;
+}
+
+int cache_write(struct sector_cache *c, uint32_t sector, const void *data)
+{
+    M_REQUIRE_NON_NULL(c);
+    M_REQUIRE_NON_NULL(data);
+
+    if (!c->write_back) {
+        int err = blockdev_write(c->dev, sector, 1, data);
+        if (err != ERR_NONE) return err;
+    }
+    return cache_store(c, sector, data, c->write_back);
+}
+
+int cache_readv(struct sector_cache *c, const uint32_t *sectors, void *const *bufs, size_t n)
+{
+    M_REQUIRE_NON_NULL(c);
+    if (n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+
+    uint32_t miss[SECTOR_IOV_MAX];
+    void *miss_bufs[SECTOR_IOV_MAX];
+    for (size_t done = 0; done < n; ) {
+        const size_t len = n - done < SECTOR_IOV_MAX ? n - done : SECTOR_IOV_MAX;
+        size_t nmiss = 0;
+        for (size_t i = done; i < done + len; ++i) {
+            const int32_t slot = cache_lookup(c, sectors[i]);
+            if (slot != NO_SLOT) {
+                ++c->stats.hits;
+                c->slots[slot].referenced = 1;
+                memcpy(bufs[i], c->slots[slot].data, SECTOR_SIZE);
+            } else {
+                ++c->stats.misses;
+                miss[nmiss] = sectors[i];
+                miss_bufs[nmiss] = bufs[i];
+                ++nmiss;
+            }
+        }
+
+        // the misses are fetched together, consecutive ones in a single preadv()
+        int err = blockdev_readv(c->dev, miss, miss_bufs, nmiss);
+        if (err != ERR_NONE) return err;
+        for (size_t i = 0; i < nmiss; ++i) {
+            if (cache_lookup(c, miss[i]) != NO_SLOT) continue; // listed twice
+            const int32_t slot = cache_install(c, miss[i]);
+            if (slot < 0) return slot;
+            memcpy(c->slots[slot].data, miss_bufs[i], SECTOR_SIZE);
+        }
+        done += len;
+    }
+    return ERR_NONE;
+}
+
+int cache_writev(struct sector_cache *c, const uint32_t *sectors, const void *const *bufs, size_t n)
+{
+    M_REQUIRE_NON_NULL(c);
+    if (n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+
+    if (!c->write_back) {
+        int err = blockdev_writev(c->dev, sectors, bufs, n);
+        if (err != ERR_NONE) return err;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        int err = cache_store(c, sectors[i], bufs[i], c->write_back);
+        if (err != ERR_NONE) return err;
+    }
+    return ERR_NONE;
+}
+
+int cache_prefetch(struct sector_cache *c, const uint32_t *sectors, size_t n)
+{
+    M_REQUIRE_NON_NULL(c);
+    if (n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+
+    // a hint must never flush out more than half of the cache
+    if (n > c->nslots / 2) n = c->nslots / 2;
+    if (n > SECTOR_IOV_MAX) n = SECTOR_IOV_MAX;
+
+    uint32_t miss[SECTOR_IOV_MAX];
+    void *bufs[SECTOR_IOV_MAX];
+    uint8_t *data = malloc(n * SECTOR_SIZE);
+    if (data == NULL) return ERR_NOMEM;
+    size_t nmiss = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (cache_lookup(c, sectors[i]) != NO_SLOT) continue;
+        miss[nmiss] = sectors[i];
+        bufs[nmiss] = data + nmiss * SECTOR_SIZE;
+        ++nmiss;
+    }
+
+    int err = blockdev_readv(c->dev, miss, bufs, nmiss);
+    for (size_t i = 0; err == ERR_NONE && i < nmiss; ++i) {
+        if (cache_lookup(c, miss[i]) != NO_SLOT) continue; // listed twice
+        const int32_t slot = cache_install(c, miss[i]);
+        if (slot < 0) {
+            err = slot;
+            break;
+        }
+        memcpy(c->slots[slot].data, bufs[i], SECTOR_SIZE);
+        // not referenced yet: a prefetched sector never used is the first to go
+        c->slots[slot].referenced = 0;
+        ++c->stats.prefetched;
+    }
+    free(data);
+    return err;
+}
+
+static int cache_cmp_sector(const void *a, const void *b)
+{
+    const uint32_t x = (*(struct cache_entry * const *) a)->sector;
+    const uint32_t y = (*(struct cache_entry * const *) b)->sector;
+    return (x > y) - (x < y);
+}
+
+int cache_flush(struct sector_cache *c)
+{
+    M_REQUIRE_NON_NULL(c);
+
+    size_t ndirty = 0;
+    for (size_t i = 0; i < c->nslots; ++i) {
+        if (c->slots[i].valid && c->slots[i].dirty) ++ndirty;
+    }
+    if (ndirty == 0) return ERR_NONE;
+
+    struct cache_entry **dirty = malloc(ndirty * sizeof(struct cache_entry *));
+    uint32_t *sectors = malloc(ndirty * sizeof(uint32_t));
+    const void **bufs = malloc(ndirty * sizeof(void *));
+    if (dirty == NULL || sectors == NULL || bufs == NULL) {
+        free(dirty);
+        free(sectors);
+        free(bufs);
+        return ERR_NOMEM;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < c->nslots; ++i) {
+        if (c->slots[i].valid && c->slots[i].dirty) dirty[n++] = &c->slots[i];
+    }
+
+    // increasing sector order keeps the write-back sequential on disk,
+    // and lets runs of consecutive sectors go out in a single pwritev()
+    qsort(dirty, ndirty, sizeof(struct cache_entry *), cache_cmp_sector);
+    for (size_t i = 0; i < ndirty; ++i) {
+        sectors[i] = dirty[i]->sector;
+        bufs[i] = dirty[i]->data;
+    }
+    int err = blockdev_writev(c->dev, sectors, bufs, ndirty);
+    if (err == ERR_NONE) {
+        for (size_t i = 0; i < ndirty; ++i) {
+            dirty[i]->dirty = 0;
+        }
+        c->stats.writebacks += ndirty;
+    }
+    free(dirty);
+    free(sectors);
+    free(bufs);
+    return err;
+}
+
+void cache_invalidate(struct sector_cache *c, uint32_t sector)
+{
+    if (c == NULL) return;
+    const int32_t slot = cache_lookup(c, sector);
+    if (slot == NO_SLOT) return;
+    cache_unlink(c, slot);
+    c->slots[slot].valid = 0;
+    c->slots[slot].dirty = 0;
+}
+
+void cache_print_stats(const struct sector_cache *c)
+{
+    if (c == NULL) return;
+    const uint64_t total = c->stats.hits + c->stats.misses;
+    pps_printf("**********SECTOR CACHE STATS**********\n");
+    pps_printf("%-20s: %zu\n", "slots", c->nslots);
+    pps_printf("%-20s: %" PRIu64 "\n", "hits", c->stats.hits);
+    pps_printf("%-20s: %" PRIu64 "\n", "misses", c->stats.misses);
+    pps_printf("%-20s: %.1f%%\n", "hit ratio", total ? 100.0 * (double) c->stats.hits / (double) total : 0.0);
+    pps_printf("%-20s: %" PRIu64 "\n", "evictions", c->stats.evictions);
+    pps_printf("%-20s: %" PRIu64 "\n", "writebacks", c->stats.writebacks);
+    pps_printf("%-20s: %" PRIu64 "\n", "prefetched", c->stats.prefetched);
+    pps_printf("**********SECTOR CACHE STATS END******\n");
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+/**
+ * @file cache.h
+ * @brief write-back sector cache between the filesystem layers and the block device
+ *
+ * The cache holds a fixed number of sectors (derived from a memory budget)
+ * and evicts them with the CLOCK (second chance) algorithm.
+ * In write-back mode, writes only mark the cached copy dirty; dirty sectors
+ * reach the disk when they are evicted or when cache_flush() is called
+ * (e.g. by umountv6()). In write-through mode, the disk is updated at once.
+ *
+ * @date spring 2023
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "unixv6fs.h"
+#include "blockdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_DEFAULT_SIZE (1 << 20) /* bytes, i.e. 2048 sectors */
+
+struct cache_entry {
+    uint32_t sector;            // the sector held in this slot
+    int32_t next;               // next slot of the same hash bucket (-1: end of chain)
+    uint8_t valid;              // does this slot hold a sector?
+    uint8_t dirty;              // must the slot be written back before eviction?
+    uint8_t referenced;         // CLOCK reference bit
+    uint8_t data[SECTOR_SIZE];  // the content of the sector
+};
+
+struct cache_stats {
+    uint64_t hits;              // reads/writes served from memory
+    uint64_t misses;            // reads that had to go to disk
+    uint64_t evictions;         // valid slots reused for another sector
+    uint64_t writebacks;        // dirty sectors written to disk
+    uint64_t prefetched;        // sectors read ahead by cache_prefetch()
+};
+
+struct sector_cache {
+    struct blockdev *dev;       // the underlying device
+    int write_back;             // defer writes until eviction/flush?
+    size_t nslots;              // number of sectors the cache can hold
+    size_t hand;                // CLOCK hand
+    size_t nbuckets;            // size of the hash table (power of two)
+    int32_t *buckets;           // hash table: first slot of each bucket (-1: empty)
+    struct cache_entry *slots;  // the cached sectors
+    struct cache_stats stats;   // hit/miss counters
+};
+
+/**
+ * @brief allocate a sector cache on top of the given device
+ * @param dev the device (not owned by the cache)
+ * @param size the memory budget of the cache, in bytes (at least SECTOR_SIZE)
+ * @param write_back non-zero to defer writes, 0 to write through
+ * @return a pointer to the newly created cache or NULL on failure
+ */
+struct sector_cache *cache_alloc(struct blockdev *dev, size_t size, int write_back);
+
+/**
+ * @brief read one sector, from memory if it is cached, from disk otherwise
+ * @param c the cache
+ * @param sector the location (in sector units) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int cache_read(struct sector_cache *c, uint32_t sector, void *data);
+
+/**
+ * @brief write one sector into the cache; in write-back mode, the disk is updated later
+ * @param c the cache
+ * @param sector the location (in sector units) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int cache_write(struct sector_cache *c, uint32_t sector, const void *data);
+
+/**
+ * @brief read a scatter list of sectors: cached ones are copied from memory,
+ *        the misses are read together with blockdev_readv() (on files, one
+ *        preadv() per run of consecutive sectors) and then cached
+ * @param c the cache
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int cache_readv(struct sector_cache *c, const uint32_t *sectors, void *const *bufs, size_t n);
+
+/**
+ * @brief write a scatter list of sectors into the cache; in write-through
+ *        mode, they all reach the device with one blockdev_writev()
+ * @param c the cache
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int cache_writev(struct sector_cache *c, const uint32_t *sectors, const void *const *bufs, size_t n);
+
+/**
+ * @brief bring sectors into the cache ahead of their use (readahead): the
+ *        ones not cached yet are read together with one blockdev_readv();
+ *        at most half of the cache (and SECTOR_IOV_MAX sectors) is used
+ * @param c the cache
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int cache_prefetch(struct sector_cache *c, const uint32_t *sectors, size_t n);
+
+/**
+ * @brief write all dirty sectors back to disk, in increasing sector order
+ * @param c the cache
+ * @return 0 on success; <0 on error
+ */
+int cache_flush(struct sector_cache *c);
+
+/**
+ * @brief forget the cached copy of a sector, if any, e.g. after it was
+ *        written to the device past the cache (a dirty copy is dropped)
+ * @param c the cache
+ * @param sector the location of the sector (in sector units) within the virtual disk
+ */
+void cache_invalidate(struct sector_cache *c, uint32_t sector);
+
+/**
+ * @brief release the memory of the cache (dirty sectors are NOT written back)
+ * @param c the cache
+ */
+void cache_free(struct sector_cache *c);
+
+/**
+ * @brief print the hit/miss counters of the cache to stdout
+ * @param c the cache
+ */
+void cache_print_stats(const struct sector_cache *c);
+
+#ifdef __cplusplus
+}
+#endif
@@ -235,7 +235,7 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
 
     int inr_parent = check_valid_entry(u, entry);
     if(inr_parent < 0) return inr_parent;
-    int inr = inode_alloc(u);
+    int inr = inode_alloc_near(u, inr_parent, mode);
     if(inr < 0) return inr;
 
     struct inode in;
@@ -261,7 +261,9 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
     int error_open = filev6_open(u, inr_parent, &f);
     if(error_open < 0) return error_open;
     int err_write = filev6_writebytes(&f, &d, sizeof(struct direntv6));
-    if(err < 0) return err;
+    int err_close = filev6_close(&f);
+    if(err_write < 0) return err_write;
+    if(err_close < 0) return err_close;
     return inr;
 }
 
@@ -318,8 +320,10 @@ int direntv6_addfile(struct unix_filesystem *u, const char *entry, uint16_t mode
     if(err_open < 0) return err_open;
 
     int err_write = filev6_writebytes(&file, buf, size);
+    int err_close = filev6_close(&file);
     if(err_write < 0) return err_write;
-    
+    if(err_close < 0) return err_close;
+
     return ERR_NONE;
 }
 
@@ -14,12 +14,67 @@
 int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *f){
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(f);
-    f->u = u;   
+    struct inode inode;
+    memset(&inode, 0 , sizeof(struct inode));
+    int inode_read_error = inode_read(u, inr, &inode);
+    filev6_open_inode(u, inr, &inode, f);
+    return inode_read_error;
+}
+
+/**
+* @brief open the file of an inode already read (e.g. by inode_iter_next());
+*        set offset to zero
+* @param u the filesystem (IN)
+* @param inr the inode number (IN)
+* @param inode the content of the inode (IN)
+* @param fv6 the complete filev6 data structure (OUT)
+* @return 0 on success; <0 on error
+*/
+int filev6_open_inode(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode, struct filev6 *f){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(inode);
+    M_REQUIRE_NON_NULL(f);
+    f->u = (struct unix_filesystem *) u;
     f->i_number = inr;
+    f->i_node = *inode;
     f->offset = 0;
-    memset(&f->i_node, 0 , sizeof(struct inode));
-    int inode_read_error = inode_read(u, inr, &(f->i_node));
-    return inode_read_error;
+    f->dirty = 0;
+    f->ra_next = 0;
+    f->ra_end = 0;
+    f->ra_window = 0;
+    f->map_valid = 0;
+    f->map_dirty = 0;
+    f->pa_ind = f->pa_ind_end = 0;
+    f->pa_data = f->pa_data_end = 0;
+    return ERR_NONE;
+}
+
+/**
+* @brief identify the sector that corresponds to a given portion of the file
+*        (see inode_findsector()); the indirect sectors of large files are
+*        read once, into the block map of the filev6
+* @param fv6 the filev6 (IN-OUT; its block map may be completed)
+* @param file_sec_off the offset within the file (in sector-size units)
+* @return >0: the sector on disk;  <0 error
+*/
+int filev6_findsector(struct filev6 *fv6, int32_t file_sec_off){
+    M_REQUIRE_NON_NULL(fv6);
+    const struct inode *i = &fv6->i_node;
+    const int32_t size = inode_getsize(i);
+    // small files need no metadata I/O; errors are reported by inode_findsector() too
+    if(!(i->i_mode & IALLOC) || size <= ADDR_SMALL_LENGTH * SECTOR_SIZE
+       || size > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE
+       || file_sec_off < 0 || file_sec_off > (size - 1) / SECTOR_SIZE){
+        return inode_findsector(fv6->u, i, file_sec_off);
+    }
+
+    const int index = file_sec_off / ADDRESSES_PER_SECTOR;
+    if(!(fv6->map_valid & (1u << index))){
+        int err = u6fs_sector_read(fv6->u, i->i_addr[index], fv6->map[index]);
+        if(err != ERR_NONE) return err;
+        fv6->map_valid |= (uint8_t) (1u << index);
+    }
+    return fv6->map[index][file_sec_off % ADDRESSES_PER_SECTOR];
 }
 
 /**
@@ -30,33 +85,169 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *f)
 * the appropriate error code (<0) on error
 */
 int filev6_readblock(struct filev6 *fv6, void *buf){
+    return filev6_readblocks(fv6, buf, 1);
+}
+
+/**
+* @brief detect sequential reads and prefetch the sectors which follow them,
+*        together with the indirect sector the next window will need
+* @param fv6 the filev6 (IN-OUT; readahead state will be changed)
+* @param first the first file sector about to be read
+* @param nb the number of sectors about to be read
+*/
+static void filev6_readahead(struct filev6 *fv6, int32_t first, size_t nb){
+    if(fv6->offset != fv6->ra_next){
+        // random access: the window starts over at the next sequential read
+        fv6->ra_window = 0;
+        fv6->ra_end = 0;
+        return;
+    }
+    // go further only once half of what was read ahead has been consumed
+    const int32_t stop = first + (int32_t) nb;
+    if(fv6->ra_window != 0 && fv6->ra_end - stop >= (int32_t) fv6->ra_window / 2) return;
+    fv6->ra_window = fv6->ra_window == 0 ? FILEV6_RA_MIN : 2 * fv6->ra_window;
+    if(fv6->ra_window > FILEV6_RA_MAX) fv6->ra_window = FILEV6_RA_MAX;
+    const int32_t window = (int32_t) fv6->ra_window;
+
+    const int32_t size = inode_getsize(&fv6->i_node);
+    const int32_t nsectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    // the sectors about to be read are part of the batch, so that they come in the same call
+    int32_t from = fv6->ra_end > first ? fv6->ra_end : first;
+    int32_t to = stop + window;
+    if(to > nsectors) to = nsectors;
+    if(to > from + SECTOR_IOV_MAX - 1) to = from + SECTOR_IOV_MAX - 1;
+
+    uint32_t sectors[SECTOR_IOV_MAX];
+    size_t n = 0;
+    int32_t off = from;
+    for(; off < to; ++off){
+        int num_sector = filev6_findsector(fv6, off);
+        if(num_sector < 0) break;
+        sectors[n++] = (uint32_t) num_sector;
+    }
+    fv6->ra_end = off;
+    // the addresses of the next window may be in the next indirect sector
+    if(n > 0 && size > ADDR_SMALL_LENGTH * SECTOR_SIZE){
+        int32_t next = off + window - 1;
+        if(next >= nsectors) next = nsectors - 1;
+        if(next / ADDRESSES_PER_SECTOR != (off - 1) / ADDRESSES_PER_SECTOR){
+            sectors[n++] = fv6->i_node.i_addr[next / ADDRESSES_PER_SECTOR];
+        }
+    }
+
+    // only a hint: a failure shows up, if at all, when the sector is really read
+    (void) u6fs_sector_prefetch(fv6->u, sectors, n);
+}
+
+/**
+* @brief read at most count sectors (and at most SECTOR_IOV_MAX) from the file
+*        at the current cursor; the sectors are fetched together, so that
+*        those which are consecutive on disk are read in a single system call
+* @param fv6 the filev6 (IN-OUT; offset will be changed)
+* @param buf points to count * SECTOR_SIZE bytes of available memory (OUT)
+* @param count the maximum number of sectors to read
+* @return >0: the number of bytes of the file read; 0: end of file;
+* the appropriate error code (<0) on error
+*/
+int filev6_readblocks(struct filev6 *fv6, void *buf, size_t count){
     M_REQUIRE_NON_NULL(fv6);
     M_REQUIRE_NON_NULL(buf);
     int32_t size = inode_getsize(&(fv6->i_node));
     int32_t current_cursor = fv6->offset;
 
-    if(current_cursor == size){
+    if(current_cursor == size || count == 0){
         return 0;
     }
 
-    int num_sector = inode_findsector(fv6->u, &(fv6->i_node), current_cursor / SECTOR_SIZE);
-    if(num_sector < 0){
-        return num_sector;
+    // past the end, inode_findsector() reports the error
+    size_t nb = current_cursor < size ? (size_t) (size - current_cursor + SECTOR_SIZE - 1) / SECTOR_SIZE : 1;
+    if(nb > count) nb = count;
+    if(nb > SECTOR_IOV_MAX) nb = SECTOR_IOV_MAX;
+    if(current_cursor < size){
+        filev6_readahead(fv6, current_cursor / SECTOR_SIZE, nb);
     }
-    int res = sector_read(fv6->u->f, num_sector, buf);
+
+    uint32_t sectors[SECTOR_IOV_MAX];
+    void *bufs[SECTOR_IOV_MAX];
+    for(size_t i = 0; i < nb; ++i){
+        int num_sector = filev6_findsector(fv6, current_cursor / SECTOR_SIZE + (int32_t) i);
+        if(num_sector < 0){
+            return num_sector;
+        }
+        sectors[i] = (uint32_t) num_sector;
+        bufs[i] = (uint8_t *) buf + i * SECTOR_SIZE;
+    }
+    int res = u6fs_sector_readv(fv6->u, sectors, bufs, nb);
     if(res != ERR_NONE){
         return res;
     }
-    else{
-        if(size >= current_cursor + SECTOR_SIZE){
-            fv6->offset += SECTOR_SIZE;
-            return SECTOR_SIZE;
-        }
-        else {
-            fv6->offset += size - current_cursor;
-            return size - current_cursor;
+
+    int32_t length = (int32_t) (nb * SECTOR_SIZE);
+    if(length > size - current_cursor){
+        length = size - current_cursor;
+    }
+    fv6->offset += length;
+    fv6->ra_next = fv6->offset;
+    return length;
+}
+
+/**
+* @brief read up to len bytes of the file from offset off, which need not be
+*        sector-aligned; whole sectors are read straight into buf (runs of
+*        SECTOR_IOV_MAX sectors, the consecutive ones with a single system
+*        call), only a partial first or last sector goes through a bounce buffer
+* @param fv6 the filev6 (IN-OUT; its cursor is left unchanged)
+* @param buf points to len bytes of available memory (OUT)
+* @param len the maximum number of bytes to read
+* @param off the offset within the file of the first byte to read
+* @return >=0: the number of bytes read (0: off at or beyond the end of file);
+* <0 on error
+*/
+int filev6_pread(struct filev6 *fv6, void *buf, size_t len, int32_t off){
+    M_REQUIRE_NON_NULL(fv6);
+    M_REQUIRE_NON_NULL(buf);
+    if(off < 0){
+        return ERR_OFFSET_OUT_OF_RANGE;
+    }
+    const int32_t size = inode_getsize(&fv6->i_node);
+    if(off >= size || len == 0){
+        return 0;
+    }
+    if(len > (size_t) (size - off)){
+        len = (size_t) (size - off);
+    }
+
+    // the reads go through the cursor, so that sequential preads are read ahead
+    const int32_t saved = fv6->offset;
+    uint8_t *out = buf;
+    size_t done = 0;
+    int err = ERR_NONE;
+    while(done < len && err == ERR_NONE){
+        const int32_t pos = off + (int32_t) done;
+        const size_t skip = (size_t) (pos % SECTOR_SIZE);
+        fv6->offset = pos - (int32_t) skip;
+        if(skip == 0 && len - done >= SECTOR_SIZE){
+            const int res = filev6_readblocks(fv6, out + done, (len - done) / SECTOR_SIZE);
+            if(res <= 0){
+                err = res < 0 ? res : ERR_IO;
+            }else{
+                done += (size_t) res;
+            }
+        }else{
+            uint8_t data[SECTOR_SIZE];
+            const int res = filev6_readblocks(fv6, data, 1);
+            if(res <= (int) skip){
+                err = res < 0 ? res : ERR_IO;
+            }else{
+                size_t n = (size_t) res - skip;
+                if(n > len - done) n = len - done;
+                memcpy(out + done, data + skip, n);
+                done += n;
+            }
         }
     }
+    fv6->offset = saved;
+    return err == ERR_NONE ? (int) done : err;
 }
 
 /**
@@ -102,15 +293,14 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6){
     int err = inode_write(u, inode_number, &inode);
     if(err < 0) return err;
 
-    fv6->i_node = inode;
-    fv6->i_number = inode_number;
-    fv6->u = u;
-    fv6->offset = 0;
-    return ERR_NONE;
+    return filev6_open_inode(u, inode_number, &inode, fv6);
 }
 
+static int filev6_writesectors(struct filev6 *fv6, const void *buf, size_t count);
+
 /**
- * @brief write the len bytes of the given buffer on disk to the given filev6
+ * @brief write the len bytes of the given buffer on disk to the given filev6;
+ *        its inode is only updated by filev6_flush() or filev6_close()
  * @param fv6 the filev6 (IN)
  * @param buf the data we want to write (IN)
  * @param len the length of the bytes we want to write
@@ -120,21 +310,272 @@ int filev6_writebytes(struct filev6 *fv6, const void *buf, size_t len){
     M_REQUIRE_NON_NULL(fv6);
     M_REQUIRE_NON_NULL(buf);
 
-    size_t total_length_copied = 0;
-    int length_copied = SECTOR_SIZE;
-    while(length_copied != 0){
-        length_copied = filev6_writesector(fv6, buf + total_length_copied, len - total_length_copied);
-        if(length_copied < 0) return length_copied;
-        total_length_copied += length_copied;
+    // the whole size is known: place the file in one run, unless the caller did
+    const int own_reservation = fv6->pa_ind == fv6->pa_ind_end && fv6->pa_data == fv6->pa_data_end;
+    if(own_reservation){
+        int err = filev6_prealloc(fv6, len);
+        if(err < 0) return err;
+    }
+
+    const uint8_t *src = buf;
+    size_t left = len;
+    int err = ERR_NONE;
+    // head: complete the last sector of the file (the only read-modify-write)
+    if(left > 0 && inode_getsize(&fv6->i_node) % SECTOR_SIZE != 0){
+        err = filev6_writesector(fv6, src, left);
+        if(err > 0){
+            src += err;
+            left -= (size_t) err;
+        }
     }
+    // whole sectors, straight from buf, SECTOR_IOV_MAX per vectored write
+    while(err >= 0 && left >= SECTOR_SIZE){
+        const size_t count = left / SECTOR_SIZE < SECTOR_IOV_MAX ? left / SECTOR_SIZE : SECTOR_IOV_MAX;
+        err = filev6_writesectors(fv6, src, count);
+        if(err > 0){
+            src += err;
+            left -= (size_t) err;
+        }
+    }
+    // tail: a new, zero-padded sector
+    if(err >= 0 && left > 0) err = filev6_writesector(fv6, src, left);
+
+    if(own_reservation) filev6_release(fv6);
+    return err < 0 ? err : ERR_NONE;
+}
+
+/**
+ * @brief write the inode of the file back if a write changed it (its size
+ *        and addresses are only kept in the filev6 until then), after the
+ *        indirect sectors changed since the last flush, in one batch
+ * @param fv6 the filev6 (IN-OUT)
+ * @return 0 on success; <0 on error
+ */
+int filev6_flush(struct filev6 *fv6){
+    M_REQUIRE_NON_NULL(fv6);
+    if(!fv6->dirty) return ERR_NONE;
+
+    // the indirect sectors first: the inode must never point to stale ones
+    uint32_t sectors[ADDR_SMALL_LENGTH - 1];
+    const void *bufs[ADDR_SMALL_LENGTH - 1];
+    size_t n = 0;
+    for(int i = 0; i < ADDR_SMALL_LENGTH - 1; ++i){
+        if(fv6->map_dirty & (1u << i)){
+            sectors[n] = fv6->i_node.i_addr[i];
+            bufs[n++] = fv6->map[i];
+        }
+    }
+    int err = u6fs_sector_writev(fv6->u, sectors, bufs, n);
+    if(err < 0) return err;
+    fv6->map_dirty = 0;
+
+    err = inode_write(fv6->u, fv6->i_number, &fv6->i_node);
+    if(err < 0) return err;
+    fv6->dirty = 0;
     return ERR_NONE;
 }
 
 /**
- * @brief write the min(SECTR_SIZE, len) bytes of the given buffer on disk to the given filev6 in a sector
- * @param fv6 the filev6 (IN)
+ * @brief done writing to the file: give the unused preallocated sectors
+ *        back and flush its inode
+ * @param fv6 the filev6 (IN-OUT)
+ * @return 0 on success; <0 on error
+ */
+int filev6_close(struct filev6 *fv6){
+    M_REQUIRE_NON_NULL(fv6);
+    filev6_release(fv6);
+    return filev6_flush(fv6);
+}
+
+/**
+ * @brief where to look for the next sectors of a file: right after its last
+ *        sector, or at the start of the allocation group of its inode
+ * @param fv6 the filev6 (IN-OUT; its block map may be completed)
+ * @return the location (in sector units) to start searching from
+ */
+static uint32_t filev6_goal(struct filev6 *fv6){
+    const int32_t size = inode_getsize(&fv6->i_node);
+    if(size > 0){
+        int last = filev6_findsector(fv6, (size - 1) / SECTOR_SIZE);
+        if(last > 0) return (uint32_t) last + 1;
+    }
+    return mountv6_group_first_sector(fv6->u, mountv6_inode_group(fv6->u, fv6->i_number));
+}
+
+/**
+ * @brief reserve, as one run of consecutive sectors, every sector needed to
+ *        append len bytes to the file: the new indirect sectors first (if
+ *        the file is or becomes large), then the data sectors, in file
+ *        order. The following writes take their sectors from the
+ *        reservation, so that the file can later be read sequentially.
+ *        A reservation is only a hint: without a free run that long (or if
+ *        one is already held), nothing is reserved and the sectors are
+ *        allocated one at a time
+ * @param fv6 the filev6 (IN-OUT)
+ * @param len the number of bytes that will be appended
+ * @return 0 on success; <0 on error
+ */
+int filev6_prealloc(struct filev6 *fv6, size_t len){
+    M_REQUIRE_NON_NULL(fv6);
+    M_REQUIRE_NON_NULL(fv6->u);
+    int err = mountv6_bitmaps(fv6->u);
+    if(err < 0) return err;
+    if(fv6->pa_ind != fv6->pa_ind_end || fv6->pa_data != fv6->pa_data_end) return ERR_NONE;
+
+    const size_t size = (size_t) inode_getsize(&fv6->i_node);
+    const size_t final_size = size + len;
+    // too large: filev6_writesector() reports it
+    if(final_size > (size_t) (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_NONE;
+
+    const size_t nb = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    const size_t final_nb = (final_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    size_t nind = 0;
+    if(final_size > ADDR_SMALL_LENGTH * SECTOR_SIZE){
+        const size_t has = size > ADDR_SMALL_LENGTH * SECTOR_SIZE ? (nb + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR : 0;
+        nind = (final_nb + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR - has;
+    }
+    const size_t total = final_nb - nb + nind;
+    // a single sector is placed just as well by the sector allocator
+    if(total <= 1) return ERR_NONE;
+
+    int first = bm_alloc_run_from(fv6->u->fbm, filev6_goal(fv6), total);
+    if(first == ERR_BITMAP_FULL) return ERR_NONE;
+    if(first < 0) return first;
+
+    fv6->pa_ind = (uint32_t) first;
+    fv6->pa_ind_end = fv6->pa_data = (uint32_t) (first + nind);
+    fv6->pa_data_end = (uint32_t) (first + total);
+    return ERR_NONE;
+}
+
+/**
+ * @brief give the preallocated sectors which were not used back to the bitmap
+ * @param fv6 the filev6 (may be NULL)
+ */
+void filev6_release(struct filev6 *fv6){
+    if(fv6 == NULL || fv6->u == NULL || fv6->u->fbm == NULL) return;
+    for(uint32_t s = fv6->pa_ind; s < fv6->pa_ind_end; ++s) bm_clear(fv6->u->fbm, s);
+    for(uint32_t s = fv6->pa_data; s < fv6->pa_data_end; ++s) bm_clear(fv6->u->fbm, s);
+    fv6->pa_ind = fv6->pa_ind_end = 0;
+    fv6->pa_data = fv6->pa_data_end = 0;
+}
+
+/**
+ * @brief give the next sector of the reservation, or allocate one
+ * @param fv6 the filev6 (IN-OUT)
+ * @param indirect non-zero for an indirect sector, 0 for a data sector
+ * @return the sector on success; <0 on error
+ */
+static int filev6_take_sector(struct filev6 *fv6, int indirect){
+    uint32_t *next = indirect ? &fv6->pa_ind : &fv6->pa_data;
+    const uint32_t end = indirect ? fv6->pa_ind_end : fv6->pa_data_end;
+    if(*next < end) return (int) (*next)++;
+    int err = mountv6_bitmaps(fv6->u);
+    if(err < 0) return err;
+    return bm_alloc_from(fv6->u->fbm, filev6_goal(fv6));
+}
+
+/**
+ * @brief record where the sector appended to the file is on disk; the file
+ *        must be file_sec_off sectors long. Its ADDR_SMALL_LENGTH+1-th sector
+ *        moves its addresses into a first indirect sector; the indirect
+ *        sectors are only changed in the block map, and written by
+ *        filev6_flush()
+ * @param fv6 the filev6 (IN-OUT)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @param sector the location (in sector units) of the sector on disk
+ * @return 0 on success; <0 on error
+ */
+static int filev6_set_sector(struct filev6 *fv6, int32_t file_sec_off, uint32_t sector){
+    struct inode *i = &fv6->i_node;
+    if(file_sec_off < 0 || file_sec_off >= (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR){
+        return ERR_FILE_TOO_LARGE;
+    }
+    const int large = inode_getsize(i) > ADDR_SMALL_LENGTH * SECTOR_SIZE;
+    if(!large && file_sec_off < ADDR_SMALL_LENGTH){
+        i->i_addr[file_sec_off] = (uint16_t) sector;
+        return ERR_NONE;
+    }
+
+    const int index = file_sec_off / ADDRESSES_PER_SECTOR;
+    if(!large || file_sec_off % ADDRESSES_PER_SECTOR == 0){
+        // a new indirect sector: the direct addresses become its first entries
+        int ind = filev6_take_sector(fv6, 1);
+        if(ind < 0) return ind;
+        memset(fv6->map[index], 0, sizeof(fv6->map[index]));
+        if(!large){
+            for(int k = 0; k < ADDR_SMALL_LENGTH; ++k){
+                fv6->map[0][k] = i->i_addr[k];
+                i->i_addr[k] = 0;
+            }
+        }
+        i->i_addr[index] = (uint16_t) ind;
+        fv6->map_valid |= (uint8_t) (1u << index);
+    }else if(!(fv6->map_valid & (1u << index))){
+        int err = u6fs_sector_read(fv6->u, i->i_addr[index], fv6->map[index]);
+        if(err != ERR_NONE) return err;
+        fv6->map_valid |= (uint8_t) (1u << index);
+    }
+    fv6->map[index][file_sec_off % ADDRESSES_PER_SECTOR] = (uint16_t) sector;
+    fv6->map_dirty |= (uint8_t) (1u << index);
+    return ERR_NONE;
+}
+
+/**
+ * @brief append count whole sectors (at most SECTOR_IOV_MAX) to a file whose
+ *        size is a multiple of SECTOR_SIZE, straight from buf, with one
+ *        vectored write
+ * @param fv6 the filev6 (IN-OUT)
+ * @param buf the data we want to write (IN; count * SECTOR_SIZE bytes)
+ * @param count the number of sectors
+ * @return number of bytes from buf written into the file on success; <0 on error
+ */
+static int filev6_writesectors(struct filev6 *fv6, const void *buf, size_t count){
+    const int32_t size = inode_getsize(&fv6->i_node);
+    if((size_t) size + count * SECTOR_SIZE > (size_t) (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE){
+        return ERR_FILE_TOO_LARGE;
+    }
+
+    uint32_t sectors[SECTOR_IOV_MAX];
+    const void *bufs[SECTOR_IOV_MAX];
+    size_t n = 0;
+    int err = ERR_NONE;
+    while(n < count){
+        int sector = filev6_take_sector(fv6, 0);
+        if(sector < 0){
+            err = sector;
+            break;
+        }
+        sectors[n] = (uint32_t) sector;
+        bufs[n] = (const uint8_t *) buf + n * SECTOR_SIZE;
+        ++n;
+    }
+    if(err == ERR_NONE) err = u6fs_sector_writev(fv6->u, sectors, bufs, n);
+    // one sector at a time: the layout of the file follows its size
+    size_t linked = 0;
+    while(err == ERR_NONE && linked < n){
+        err = filev6_set_sector(fv6, size / SECTOR_SIZE + (int32_t) linked, sectors[linked]);
+        if(err == ERR_NONE){
+            ++linked;
+            fv6->dirty = 1;
+            err = inode_setsize(&fv6->i_node, size + (int32_t) (linked * SECTOR_SIZE));
+        }
+    }
+    if(err != ERR_NONE){
+        // the sectors not linked are not part of the file
+        for(size_t i = linked; i < n; ++i) bm_clear(fv6->u->fbm, sectors[i]);
+        return err;
+    }
+    return (int) (n * SECTOR_SIZE);
+}
+
+/**
+ * @brief write the min(SECTOR_SIZE, len_left) bytes of the given buffer at the
+ *        end of the file, in its last sector if it is not full (read-modify-
+ *        write), in a new, zero-padded sector otherwise
+ * @param fv6 the filev6 (IN-OUT)
  * @param buf the data we want to write (IN)
- * @param len the length of of buffer left
+ * @param len_left the length of the buffer left
  * @return number of bytes from buf copied into the file on success; <0 on error
  */
 int filev6_writesector(struct filev6 *fv6, const void *buf, size_t len_left){
@@ -146,50 +587,45 @@ int filev6_writesector(struct filev6 *fv6, const void *buf, size_t len_left){
     if(len_left == 0) return 0;
 
     if(inode_size % SECTOR_SIZE == 0){
-        uint64_t sector_number = fv6->u->fbm->min;
-        while(sector_number <= fv6->u->fbm->max && bm_get(fv6->u->fbm, sector_number)){sector_number++;};
-
-        if(sector_number > fv6->u->fbm->max) return ERR_BITMAP_FULL;
-        bm_set(fv6->u->fbm, sector_number);
+        int sector_number = filev6_take_sector(fv6, 0);
+        if(sector_number < 0) return sector_number;
 
         char data[SECTOR_SIZE] = {0};
         int minimum = min(SECTOR_SIZE, len_left);
         memcpy(data, buf, minimum);
 
-        int err1 = sector_write(fv6->u->f, sector_number, data);
-        if(err1 < 0) return err1;
+        int err1 = u6fs_sector_write(fv6->u, sector_number, data);
+        if(err1 == ERR_NONE) err1 = filev6_set_sector(fv6, inode_size/SECTOR_SIZE, sector_number);
+        if(err1 < 0){
+            bm_clear(fv6->u->fbm, sector_number);
+            return err1;
+        }
 
         int err2 = inode_setsize(&fv6->i_node, minimum + inode_size);
         if(err2 < 0) return err2;
 
-        /*Je suppose ici que la taille des fichier sont inferieurs a 8 secteurs 
-        et ne traite pas le cas avec les plus grands fichiers.
-        Ceci implique donc que inode_size/SECTOR_SIZE < 8*/
-        fv6->i_node.i_addr[inode_size/SECTOR_SIZE] = sector_number;
-
-        int err3 = inode_write(fv6->u, fv6->i_number, &fv6->i_node);
-        if(err3 < 0) return err3;
+        fv6->dirty = 1;
 
         return minimum;
     }else{
-        int sector_number = inode_findsector(fv6->u, &fv6->i_node, inode_size/SECTOR_SIZE);
+        // the block map may be newer than the indirect sectors on disk
+        int sector_number = filev6_findsector(fv6, inode_size/SECTOR_SIZE);
         if(sector_number < 0) return sector_number;
         
         char data[SECTOR_SIZE] = {0};
-        int err = sector_read(fv6->u->f, sector_number, data);
+        int err = u6fs_sector_read(fv6->u, sector_number, data);
         if(err < 0) return err;
 
         int minimum = min(SECTOR_SIZE - inode_size % SECTOR_SIZE, len_left);
         memcpy(data + inode_size % SECTOR_SIZE, buf, minimum);
 
-        int err1 = sector_write(fv6->u->f, sector_number, data);
+        int err1 = u6fs_sector_write(fv6->u, sector_number, data);
         if(err1 < 0) return err1;
 
         int err2 = inode_setsize(&fv6->i_node, minimum + inode_size);
         if(err2 < 0) return err2;
 
-        int err3 = inode_write(fv6->u, fv6->i_number, &fv6->i_node);
-        if(err3 < 0) return err3;
+        fv6->dirty = 1;
         return minimum;
     }
 }
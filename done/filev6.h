@@ -15,11 +15,25 @@
 extern "C" {
 #endif
 
+#define FILEV6_RA_MIN 4  /* sectors read ahead once an access is found sequential */
+#define FILEV6_RA_MAX 32 /* the readahead window doubles up to this size */
+
 struct filev6 {
     struct unix_filesystem *u;    // the filesystem
     uint16_t i_number;            // the inode number (on disk)
     struct inode i_node;          // the content of the inode
     int32_t offset;               // the current cursor within the file (in bytes)
+    uint8_t dirty;                // i_node was changed by a write and not written back yet
+    int32_t ra_next;              // offset of the next read, if it is sequential
+    int32_t ra_end;               // first file sector not read ahead yet
+    uint32_t ra_window;           // current readahead window, in sectors (0: none)
+    uint8_t map_valid;            // bit i set: map[i] holds the indirect sector i_addr[i]
+    uint8_t map_dirty;            // bit i set: map[i] was changed by a write, not written to i_addr[i] yet
+    uint16_t map[ADDR_SMALL_LENGTH - 1][ADDRESSES_PER_SECTOR]; // block map of large files, built lazily
+    uint32_t pa_ind;              // preallocated indirect sectors not used yet: [pa_ind, pa_ind_end)
+    uint32_t pa_ind_end;
+    uint32_t pa_data;             // preallocated data sectors not used yet: [pa_data, pa_data_end)
+    uint32_t pa_data_end;
 };
 
 /* *************************************************** *
@@ -34,6 +48,27 @@ struct filev6 {
  */
 int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6);
 
+/**
+ * @brief open the file of an inode already read (e.g. by inode_iter_next());
+ *        set offset to zero
+ * @param u the filesystem (IN)
+ * @param inr the inode number (IN)
+ * @param inode the content of the inode (IN)
+ * @param fv6 the complete filev6 data structure (OUT)
+ * @return 0 on success; <0 on error
+ */
+int filev6_open_inode(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode, struct filev6 *fv6);
+
+/**
+ * @brief identify the sector that corresponds to a given portion of the file
+ *        (see inode_findsector()); the indirect sectors of large files are
+ *        read once, into the block map of the filev6
+ * @param fv6 the filev6 (IN-OUT; its block map may be completed)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk;  <0 error
+ */
+int filev6_findsector(struct filev6 *fv6, int32_t file_sec_off);
+
 /* *************************************************** *
  * TODO WEEK 08										   *
  * *************************************************** */
@@ -57,6 +92,34 @@ int filev6_lseek(struct filev6 *fv6, int32_t offset);
  */
 int filev6_readblock(struct filev6 *fv6, void *buf);
 
+/**
+ * @brief read at most count sectors (and at most SECTOR_IOV_MAX) from the file
+ *        at the current cursor, with one system call per run of sectors
+ *        that are consecutive on disk. When the reads are sequential, the
+ *        next sectors of the file are read ahead, in a window which doubles
+ *        from FILEV6_RA_MIN up to FILEV6_RA_MAX sectors; a read elsewhere
+ *        than where the previous one stopped resets the window
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to count * SECTOR_SIZE bytes of available memory (OUT)
+ * @param count the maximum number of sectors to read
+ * @return >0: the number of bytes of the file read; 0: end of file;
+ *             the appropriate error code (<0) on error
+ */
+int filev6_readblocks(struct filev6 *fv6, void *buf, size_t count);
+
+/**
+ * @brief read up to len bytes of the file from offset off, which need not be
+ *        sector-aligned, without moving the cursor; whole sectors are read
+ *        straight into buf, consecutive ones with a single system call
+ * @param fv6 the filev6 (IN-OUT; its readahead state may be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the maximum number of bytes to read
+ * @param off the offset within the file of the first byte to read
+ * @return >=0: the number of bytes read (0: off at or beyond the end of file);
+ *             <0 on error
+ */
+int filev6_pread(struct filev6 *fv6, void *buf, size_t len, int32_t off);
+
 /* *************************************************** *
  * TODO WEEK 1										   *
  * *************************************************** */
@@ -74,7 +137,8 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6);
  * TODO WEEK 12										   *
  * *************************************************** */
 /**
- * @brief write the len bytes of the given buffer on disk to the given filev6
+ * @brief write the len bytes of the given buffer on disk to the given filev6;
+ *        its inode is only updated by filev6_flush() or filev6_close()
  * @param fv6 the filev6 (IN)
  * @param buf the data we want to write (IN)
  * @param len the length of the bytes we want to write
@@ -82,6 +146,57 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6);
  */
 int filev6_writebytes(struct filev6 *fv6, const void *buf, size_t len);
 
+/**
+ * @brief write the min(SECTOR_SIZE, len_left) bytes of the given buffer at the
+ *        end of the file, in its last sector if it is not full (read-modify-
+ *        write), in a new, zero-padded sector otherwise. Files grow up to
+ *        (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR sectors: past
+ *        ADDR_SMALL_LENGTH sectors, their addresses move to indirect sectors
+ * @param fv6 the filev6 (IN-OUT)
+ * @param buf the data we want to write (IN)
+ * @param len_left the length of the buffer left
+ * @return number of bytes from buf copied into the file on success; <0 on error
+ */
+int filev6_writesector(struct filev6 *fv6, const void *buf, size_t len_left);
+
+/**
+ * @brief write the inode of the file back if a write changed it (its size
+ *        and addresses are only kept in the filev6 until then), after the
+ *        indirect sectors changed since the last flush, in one batch
+ * @param fv6 the filev6 (IN-OUT)
+ * @return 0 on success; <0 on error
+ */
+int filev6_flush(struct filev6 *fv6);
+
+/**
+ * @brief done writing to the file: give the unused preallocated sectors
+ *        back and flush its inode
+ * @param fv6 the filev6 (IN-OUT)
+ * @return 0 on success; <0 on error
+ */
+int filev6_close(struct filev6 *fv6);
+
+/**
+ * @brief reserve, as one run of consecutive sectors, every sector needed to
+ *        append len bytes to the file: the new indirect sectors first (if
+ *        the file is or becomes large), then the data sectors, in file
+ *        order. The following writes take their sectors from the
+ *        reservation, so that the file can later be read sequentially.
+ *        A reservation is only a hint: without a free run that long (or if
+ *        one is already held), nothing is reserved and the sectors are
+ *        allocated one at a time
+ * @param fv6 the filev6 (IN-OUT)
+ * @param len the number of bytes that will be appended
+ * @return 0 on success; <0 on error
+ */
+int filev6_prealloc(struct filev6 *fv6, size_t len);
+
+/**
+ * @brief give the preallocated sectors which were not used back to the bitmap
+ * @param fv6 the filev6 (may be NULL)
+ */
+void filev6_release(struct filev6 *fv6);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,284 @@
+/**
+ * @file icache.c
+ * @brief in-memory inode cache with CLOCK eviction and deferred write-back
+ *
+ * @date spring 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "icache.h"
+#include "mount.h"
+#include "sector.h"
+#include "error.h"
+
+#define NO_SLOT ((int32_t) -1)
+
+static size_t icache_bucket(const struct inode_cache *c, uint16_t inr)
+{
+    return inr & (c->nbuckets - 1);
+}
+
+static uint32_t icache_sector(const struct inode_cache *c, uint16_t inr)
+{
+    return (uint32_t) c->u->s.s_inode_start + inr / INODES_PER_SECTOR;
+}
+
+struct inode_cache *icache_alloc(struct unix_filesystem *u, size_t size, int write_back)
+{
+    if (u == NULL || size < sizeof(struct icache_entry)) {
+        return NULL;
+    }
+
+    struct inode_cache *c = calloc(1, sizeof(struct inode_cache));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    c->u = u;
+    c->write_back = write_back;
+    c->nslots = size / sizeof(struct icache_entry);
+    c->nbuckets = 1;
+    while (c->nbuckets < c->nslots) {
+        c->nbuckets <<= 1;
+    }
+
+    c->slots = calloc(c->nslots, sizeof(struct icache_entry));
+    c->buckets = malloc(c->nbuckets * sizeof(int32_t));
+    if (c->slots == NULL || c->buckets == NULL) {
+        icache_free(c);
+        return NULL;
+    }
+    for (size_t i = 0; i < c->nbuckets; ++i) {
+        c->buckets[i] = NO_SLOT;
+    }
+
+    return c;
+}
+
+void icache_free(struct inode_cache *c)
+{
+    if (c != NULL) {
+        free(c->slots);
+        free(c->buckets);
+        free(c);
+    }
+}
+
+/**
+ * @brief find the slot holding the given inode
+ * @return the slot index, or NO_SLOT if the inode is not cached
+ */
+static int32_t icache_lookup(const struct inode_cache *c, uint16_t inr)
+{
+    int32_t i = c->buckets[icache_bucket(c, inr)];
+    while (i != NO_SLOT && c->slots[i].inr != inr) {
+        i = c->slots[i].next;
+    }
+    return i;
+}
+
+static void icache_unlink(struct inode_cache *c, int32_t slot)
+{
+    int32_t *link = &c->buckets[icache_bucket(c, c->slots[slot].inr)];
+    while (*link != slot) {
+        link = &c->slots[*link].next;
+    }
+    *link = c->slots[slot].next;
+    c->slots[slot].valid = 0;
+}
+
+/**
+ * @brief write the dirty inodes of the sector holding inr back to the inode
+ *        table, with a single read-modify-write of that sector
+ * @return 0 on success; <0 on error
+ */
+static int icache_writeback(struct inode_cache *c, uint16_t inr)
+{
+    const uint32_t sector = icache_sector(c, inr);
+    struct inode inodes[INODES_PER_SECTOR];
+    int err = u6fs_sector_read(c->u, sector, inodes);
+    if (err != ERR_NONE) return err;
+
+    const uint16_t first = (uint16_t) (inr - inr % INODES_PER_SECTOR);
+    int32_t dirty[INODES_PER_SECTOR];
+    size_t ndirty = 0;
+    for (uint16_t i = 0; i < INODES_PER_SECTOR; ++i) {
+        const int32_t slot = icache_lookup(c, (uint16_t) (first + i));
+        if (slot != NO_SLOT && c->slots[slot].dirty) {
+            inodes[i] = c->slots[slot].inode;
+            dirty[ndirty++] = slot;
+        }
+    }
+
+    err = u6fs_sector_write(c->u, sector, inodes);
+    if (err != ERR_NONE) return err;
+    for (size_t i = 0; i < ndirty; ++i) {
+        c->slots[dirty[i]].dirty = 0;
+    }
+    c->stats.writebacks += ndirty;
+    return ERR_NONE;
+}
+
+/**
+ * @brief pick a slot for a new inode (a never used one first, then CLOCK:
+ *        skip referenced slots once), writing its previous content back if
+ *        needed, and bind it to inr
+ * @return the slot index on success; <0 on error
+ */
+static int32_t icache_install(struct inode_cache *c, uint16_t inr)
+{
+    int32_t slot;
+    if (c->used < c->nslots) {
+        slot = (int32_t) c->used++;
+    } else {
+        struct icache_entry *e = &c->slots[c->hand];
+        while (e->valid && e->referenced) {
+            e->referenced = 0;
+            c->hand = (c->hand + 1) % c->nslots;
+            e = &c->slots[c->hand];
+        }
+        slot = (int32_t) c->hand;
+        c->hand = (c->hand + 1) % c->nslots;
+
+        if (e->valid) {
+            if (e->dirty) {
+                int err = icache_writeback(c, e->inr);
+                if (err != ERR_NONE) return err;
+            }
+            icache_unlink(c, slot);
+            ++c->stats.evictions;
+        }
+    }
+
+    struct icache_entry *e = &c->slots[slot];
+    const size_t b = icache_bucket(c, inr);
+    e->inr = inr;
+    e->valid = 1;
+    e->dirty = 0;
+    e->referenced = 1;
+    e->next = c->buckets[b];
+    c->buckets[b] = slot;
+    return slot;
+}
+
+int icache_read(struct inode_cache *c, uint16_t inr, struct inode *inode)
+{
+    M_REQUIRE_NON_NULL(c);
+    M_REQUIRE_NON_NULL(inode);
+
+    int32_t slot = icache_lookup(c, inr);
+    if (slot != NO_SLOT) {
+        ++c->stats.hits;
+        c->slots[slot].referenced = 1;
+        *inode = c->slots[slot].inode;
+        return ERR_NONE;
+    }
+
+    ++c->stats.misses;
+    struct inode inodes[INODES_PER_SECTOR];
+    int err = u6fs_sector_read(c->u, icache_sector(c, inr), inodes);
+    if (err != ERR_NONE) return err;
+    *inode = inodes[inr % INODES_PER_SECTOR];
+
+    // the other inodes of the sector come for free, unless the cache is tiny;
+    // those already cached may be more recent than the sector: keep them
+    const uint16_t first = (uint16_t) (inr - inr % INODES_PER_SECTOR);
+    if (c->nslots >= 4 * INODES_PER_SECTOR) {
+        uint8_t skip[INODES_PER_SECTOR];
+        for (uint16_t i = 0; i < INODES_PER_SECTOR; ++i) {
+            const uint16_t n = (uint16_t) (first + i);
+            skip[i] = n == inr || n < ROOT_INUMBER || icache_lookup(c, n) != NO_SLOT;
+        }
+        for (uint16_t i = 0; i < INODES_PER_SECTOR; ++i) {
+            if (skip[i]) continue;
+            slot = icache_install(c, (uint16_t) (first + i));
+            if (slot < 0) return slot;
+            c->slots[slot].inode = inodes[i];
+            c->slots[slot].referenced = 0;
+        }
+    }
+
+    slot = icache_install(c, inr);
+    if (slot < 0) return slot;
+    c->slots[slot].inode = *inode;
+    return ERR_NONE;
+}
+
+int icache_write(struct inode_cache *c, uint16_t inr, const struct inode *inode)
+{
+    M_REQUIRE_NON_NULL(c);
+    M_REQUIRE_NON_NULL(inode);
+
+    int32_t slot = icache_lookup(c, inr);
+    if (slot != NO_SLOT) {
+        ++c->stats.hits;
+        c->slots[slot].referenced = 1;
+    } else {
+        // the whole inode is replaced: no need to read it first
+        slot = icache_install(c, inr);
+        if (slot < 0) return slot;
+    }
+    c->slots[slot].inode = *inode;
+    c->slots[slot].dirty = 1;
+    if (c->write_back) return ERR_NONE;
+
+    int err = icache_writeback(c, inr);
+    if (err != ERR_NONE) {
+        // never keep a copy which differs from the inode table
+        icache_unlink(c, slot);
+    }
+    return err;
+}
+
+int icache_peek(const struct inode_cache *c, uint16_t inr, struct inode *inode)
+{
+    if (c == NULL || inode == NULL) return 0;
+    const int32_t slot = icache_lookup(c, inr);
+    if (slot == NO_SLOT) return 0;
+    *inode = c->slots[slot].inode;
+    return 1;
+}
+
+void icache_prime(struct inode_cache *c, uint32_t sector, const struct inode *inodes)
+{
+    if (c == NULL || inodes == NULL || sector < c->u->s.s_inode_start) return;
+    const uint32_t first = (sector - c->u->s.s_inode_start) * INODES_PER_SECTOR;
+    for (uint32_t i = 0; i < INODES_PER_SECTOR && c->used < c->nslots; ++i) {
+        const uint32_t inr = first + i;
+        if (inr < ROOT_INUMBER || inr > UINT16_MAX) continue;
+        if (icache_lookup(c, (uint16_t) inr) != NO_SLOT) continue;
+        const int32_t slot = icache_install(c, (uint16_t) inr);
+        c->slots[slot].inode = inodes[i];
+        c->slots[slot].referenced = 0;
+    }
+}
+
+int icache_flush(struct inode_cache *c)
+{
+    M_REQUIRE_NON_NULL(c);
+
+    // each write-back also cleans the other dirty inodes of the same sector
+    for (size_t i = 0; i < c->nslots; ++i) {
+        if (c->slots[i].valid && c->slots[i].dirty) {
+            int err = icache_writeback(c, c->slots[i].inr);
+            if (err != ERR_NONE) return err;
+        }
+    }
+    return ERR_NONE;
+}
+
+void icache_print_stats(const struct inode_cache *c)
+{
+    if (c == NULL) return;
+    const uint64_t total = c->stats.hits + c->stats.misses;
+    pps_printf("**********INODE CACHE STATS**********\n");
+    pps_printf("%-20s: %zu\n", "slots", c->nslots);
+    pps_printf("%-20s: %" PRIu64 "\n", "hits", c->stats.hits);
+    pps_printf("%-20s: %" PRIu64 "\n", "misses", c->stats.misses);
+    pps_printf("%-20s: %.1f%%\n", "hit ratio", total ? 100.0 * (double) c->stats.hits / (double) total : 0.0);
+    pps_printf("%-20s: %" PRIu64 "\n", "evictions", c->stats.evictions);
+    pps_printf("%-20s: %" PRIu64 "\n", "writebacks", c->stats.writebacks);
+    pps_printf("**********INODE CACHE STATS END******\n");
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+/**
+ * @file icache.h
+ * @brief in-memory inode cache, keyed by inode number
+ *
+ * The cache keeps decoded inodes so that inode_read() does not fetch and
+ * copy a whole sector of the inode table for each 32-byte inode, and
+ * inode_write() does not read-modify-write that sector every time.
+ * A miss loads every inode of the sector (they are already in memory),
+ * and the mount scan primes the cache while it still has unused slots.
+ *
+ * In write-back mode, written inodes are only marked dirty; they reach
+ * the inode table when they are evicted or when icache_flush() is called
+ * (e.g. by umountv6()), the dirty inodes of a sector being written with a
+ * single read-modify-write of that sector. In write-through mode, the
+ * inode table is updated at once.
+ *
+ * Entries are evicted with the CLOCK (second chance) algorithm, as in the
+ * sector cache.
+ *
+ * @date spring 2023
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ICACHE_DEFAULT_SIZE (64 << 10) /* bytes, i.e. about 1500 inodes */
+
+struct unix_filesystem;
+
+struct icache_entry {
+    uint16_t inr;               // the inode held in this slot
+    uint8_t valid;              // does this slot hold an inode?
+    uint8_t dirty;              // must the inode be written back before eviction?
+    uint8_t referenced;         // CLOCK reference bit
+    int32_t next;               // next slot of the same hash bucket (-1: end of chain)
+    struct inode inode;         // the content of the inode, as on disk
+};
+
+struct icache_stats {
+    uint64_t hits;              // inodes read/written in memory
+    uint64_t misses;            // reads that had to go to the inode table
+    uint64_t evictions;         // valid slots reused for another inode
+    uint64_t writebacks;        // dirty inodes written to the inode table
+};
+
+struct inode_cache {
+    struct unix_filesystem *u;  // the filesystem whose inode table is cached
+    int write_back;             // defer writes until eviction/flush?
+    size_t nslots;              // number of inodes the cache can hold
+    size_t used;                // slots used at least once
+    size_t hand;                // CLOCK hand
+    size_t nbuckets;            // size of the hash table (power of two)
+    int32_t *buckets;           // hash table: first slot of each bucket (-1: empty)
+    struct icache_entry *slots; // the cached inodes
+    struct icache_stats stats;  // hit/miss counters
+};
+
+/**
+ * @brief allocate an inode cache for the given filesystem
+ * @param u the filesystem (its superblock must be read already)
+ * @param size the memory budget of the cache, in bytes (enough for at least one inode)
+ * @param write_back non-zero to defer writes, 0 to write through
+ * @return a pointer to the newly created cache or NULL on failure
+ */
+struct inode_cache *icache_alloc(struct unix_filesystem *u, size_t size, int write_back);
+
+/**
+ * @brief read one inode, from memory if it is cached, from the inode table otherwise
+ * @param c the cache
+ * @param inr the inode number (must be within the inode table)
+ * @param inode the inode, as on disk, allocated or not (OUT)
+ * @return 0 on success; <0 on error
+ */
+int icache_read(struct inode_cache *c, uint16_t inr, struct inode *inode);
+
+/**
+ * @brief write one inode into the cache; in write-back mode, the inode table is updated later
+ * @param c the cache
+ * @param inr the inode number (must be within the inode table)
+ * @param inode the inode (IN)
+ * @return 0 on success; <0 on error
+ */
+int icache_write(struct inode_cache *c, uint16_t inr, const struct inode *inode);
+
+/**
+ * @brief give the cached copy of an inode, if any, without loading it nor
+ *        counting a hit or a miss (e.g. to see the inodes not written back
+ *        yet when walking the inode table on disk)
+ * @param c the cache (may be NULL)
+ * @param inr the inode number
+ * @param inode the cached inode (OUT; only set if it is cached)
+ * @return 1 if the inode is cached, 0 otherwise
+ */
+int icache_peek(const struct inode_cache *c, uint16_t inr, struct inode *inode);
+
+/**
+ * @brief cache the inodes of a sector of the inode table read by someone
+ *        else, but only into slots never used so far (nothing is evicted,
+ *        nothing cached is replaced)
+ * @param c the cache
+ * @param sector the location of the sector (in sector units) within the virtual disk
+ * @param inodes the INODES_PER_SECTOR inodes of that sector
+ */
+void icache_prime(struct inode_cache *c, uint32_t sector, const struct inode *inodes);
+
+/**
+ * @brief write all dirty inodes back to the inode table, one sector at a time
+ * @param c the cache
+ * @return 0 on success; <0 on error (the remaining inodes stay dirty)
+ */
+int icache_flush(struct inode_cache *c);
+
+/**
+ * @brief free the cache, without flushing it
+ * @param c the cache (may be NULL)
+ */
+void icache_free(struct inode_cache *c);
+
+/**
+ * @brief print the hit/miss statistics of the cache
+ * @param c the cache
+ */
+void icache_print_stats(const struct inode_cache *c);
+
+#ifdef __cplusplus
+}
+#endif
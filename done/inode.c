@@ -2,12 +2,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include "unixv6fs.h"
 #include "sector.h"
 #include "mount.h"
 #include "error.h"
 #include "inode.h"
+#include "icache.h"
 
 
 /**
@@ -18,19 +20,80 @@
  */
 int inode_scan_print(const struct unix_filesystem *u){
     M_REQUIRE_NON_NULL(u);
-    uint16_t size_sector = (u->s).s_isize;
+    struct inode_iter it;
+    int err = inode_iter_init(u, &it);
+    if(err != ERR_NONE) return err;
+
+    uint16_t inr = 0;
     struct inode in;
     memset(&in, 0, sizeof(struct inode));
-    for(size_t ind = ROOT_INUMBER; ind < size_sector * INODES_PER_SECTOR; ++ind){
-        int res = inode_read(u, (uint16_t)ind, &in);
-        if(res == ERR_NONE){
-            pps_printf("inode %zu (%s) len %d\n", ind, in.i_mode & IFDIR ? SHORT_DIR_NAME : SHORT_FIL_NAME, inode_getsize(&in));
-        }else if(res != ERR_UNALLOCATED_INODE){
-            return res;
-        }
+    while((err = inode_iter_next(&it, &inr, &in)) > 0){
+        pps_printf("inode %" PRIu16 " (%s) len %d\n", inr, in.i_mode & IFDIR ? SHORT_DIR_NAME : SHORT_FIL_NAME, inode_getsize(&in));
     }
+    return err;
+}
+
+/**
+ * @brief start a walk of the inode table (see inode_iter_next())
+ * @param u the filesystem (IN)
+ * @param it the iterator (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_iter_init(const struct unix_filesystem *u, struct inode_iter *it){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(it);
+    it->u = u;
+    it->sector = 0;
+    it->first = 0;
+    it->pos = 0;
+    it->count = 0;
     return ERR_NONE;
+}
 
+/**
+ * @brief give the next allocated inode of the inode table; the table is
+ *        read INODE_ITER_SECTORS sectors at a time, so that a whole walk
+ *        reads each sector once
+ * @param it the iterator (IN-OUT)
+ * @param inr the inode number of the inode (OUT)
+ * @param inode the content of the inode (OUT)
+ * @return 1 if an inode was found; 0 at the end of the table; <0 on error
+ */
+int inode_iter_next(struct inode_iter *it, uint16_t *inr, struct inode *inode){
+    M_REQUIRE_NON_NULL(it);
+    M_REQUIRE_NON_NULL(inr);
+    M_REQUIRE_NON_NULL(inode);
+    const struct unix_filesystem *u = it->u;
+
+    while(1){
+        while(it->pos < it->count){
+            const uint32_t n = it->first + (uint32_t) it->pos;
+            struct inode in = it->inodes[it->pos++];
+            if(n < ROOT_INUMBER) continue;
+            if(n > UINT16_MAX) return 0;
+            // the inode cache may hold inodes not written back yet
+            icache_peek(u->icache, (uint16_t) n, &in);
+            if(in.i_mode & IALLOC){
+                *inr = (uint16_t) n;
+                *inode = in;
+                return 1;
+            }
+        }
+
+        if(it->sector >= u->s.s_isize) return 0;
+        uint32_t count = u->s.s_isize - it->sector;
+        if(count > INODE_ITER_SECTORS) count = INODE_ITER_SECTORS;
+        const uint32_t sector = u->s.s_inode_start + it->sector;
+        int err = u6fs_sector_read_range(u, sector, count, it->inodes);
+        if(err != ERR_NONE) return err;
+        for(uint32_t i = 0; i < count; ++i){
+            icache_prime(u->icache, sector + i, &it->inodes[i * INODES_PER_SECTOR]);
+        }
+        it->first = it->sector * INODES_PER_SECTOR;
+        it->pos = 0;
+        it->count = (size_t) count * INODES_PER_SECTOR;
+        it->sector += count;
+    }
 }
 
 /**
@@ -43,20 +106,29 @@ int inode_scan_print(const struct unix_filesystem *u){
 int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inode){
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(inode);
-    FILE* f = u->f;
     uint16_t size_sector = (u->s).s_isize;
     uint16_t inode_start = (u->s).s_inode_start;
     uint32_t start = inode_start + inr / INODES_PER_SECTOR; 
 
     if(inr < ROOT_INUMBER || inr >= size_sector * INODES_PER_SECTOR){
         return ERR_INODE_OUT_OF_RANGE;
+    }else if(u->icache != NULL){
+        struct inode in;
+        int res = icache_read(u->icache, inr, &in);
+        if(res == ERR_NONE){
+            if(!(in.i_mode & IALLOC)) return ERR_UNALLOCATED_INODE;
+            *inode = in;
+        }
+        return res;
     }else{
         struct inode_sector array_inodes;
-        memset(&array_inodes, 0, sizeof(struct inode_sector));    
-        int res = sector_read(f, start, array_inodes.inodes);
+        const void *sector_data = NULL;
+        // no copy of the whole sector when the image is memory-mapped
+        int res = u6fs_sector_get(u, start, array_inodes.inodes, &sector_data);
         if(res == ERR_NONE){
-            if(array_inodes.inodes[inr % INODES_PER_SECTOR].i_mode & IALLOC){
-                *inode = array_inodes.inodes[inr % INODES_PER_SECTOR];
+            const struct inode *in = (const struct inode *) sector_data + inr % INODES_PER_SECTOR;
+            if(in->i_mode & IALLOC){
+                *inode = *in;
             }else{
                 return ERR_UNALLOCATED_INODE;
             }
@@ -94,13 +166,14 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
             && inode_size <= (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE){
                
         int address_index = file_sec_off / ADDRESSES_PER_SECTOR;
-        uint16_t addresses[ADDRESSES_PER_SECTOR] = {0};
-        int err = sector_read(u->f, i->i_addr[address_index], addresses);
+        uint16_t addresses[ADDRESSES_PER_SECTOR];
+        const void *sector_data = NULL;
+        int err = u6fs_sector_get(u, i->i_addr[address_index], addresses, &sector_data);
         if(err != ERR_NONE){
             return err;
         }
         else{
-            return addresses[file_sec_off % ADDRESSES_PER_SECTOR];
+            return ((const uint16_t *) sector_data)[file_sec_off % ADDRESSES_PER_SECTOR];
         }
     }
     //cas 3: le fichier occupe plus de 7 x 256 secteurs sur disque
@@ -110,6 +183,71 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
 }
 
 
+/**
+ * @brief give the layout of a range of a file as runs of consecutive disk
+ *        sectors; each indirect sector is read once
+ * @param u the filesystem (IN)
+ * @param i the inode (IN)
+ * @param first the first file sector of the range
+ * @param count the number of sectors of the range (clipped to the end of the file)
+ * @param runs at most max_runs runs (OUT), in increasing file order; when
+ *        they are all used, the range may go on after the last one
+ * @param max_runs the size of runs
+ * @return the number of runs (0: the range is empty); <0 on error
+ */
+int inode_map_range(const struct unix_filesystem *u, const struct inode *i, int32_t first, int32_t count,
+                    struct inode_extent *runs, size_t max_runs){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(i);
+    M_REQUIRE_NON_NULL(runs);
+
+    if(!(i->i_mode & IALLOC)){
+        return ERR_UNALLOCATED_INODE;
+    }
+    const int32_t inode_size = inode_getsize(i);
+    if(inode_size > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE){
+        return ERR_FILE_TOO_LARGE;
+    }
+    const int32_t nb_sectors = (inode_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if(first < 0 || count < 0 || first > nb_sectors){
+        return ERR_OFFSET_OUT_OF_RANGE;
+    }
+    const int32_t end = count > nb_sectors - first ? nb_sectors : first + count;
+
+    uint16_t addresses[ADDRESSES_PER_SECTOR];
+    const uint16_t *indirect = NULL;
+    int loaded = -1;
+    size_t n = 0;
+    for(int32_t off = first; off < end; ++off){
+        uint32_t sector;
+        if(inode_size <= ADDR_SMALL_LENGTH * SECTOR_SIZE){
+            sector = i->i_addr[off];
+        }else{
+            const int index = off / ADDRESSES_PER_SECTOR;
+            if(index != loaded){
+                const void *sector_data = NULL;
+                int err = u6fs_sector_get(u, i->i_addr[index], addresses, &sector_data);
+                if(err != ERR_NONE) return err;
+                indirect = sector_data;
+                loaded = index;
+            }
+            sector = indirect[off % ADDRESSES_PER_SECTOR];
+        }
+
+        if(n > 0 && runs[n - 1].sector + runs[n - 1].count == sector){
+            ++runs[n - 1].count;
+        }else if(n < max_runs){
+            runs[n].file_off = off;
+            runs[n].sector = sector;
+            runs[n].count = 1;
+            ++n;
+        }else{
+            break;
+        }
+    }
+    return (int) n;
+}
+
 /**
  * @brief write the content of an inode to disk
  * @param u the filesystem (IN)
@@ -121,14 +259,19 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, const struct inode *ino
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(inode);
 
+    if(u->flags & MOUNTV6_RDONLY) return ERR_IO;
+    if(u->icache != NULL){
+        return icache_write(u->icache, inr, inode);
+    }
+
     int sector = inr/INODES_PER_SECTOR + u->s.s_inode_start;
     struct inode data[INODES_PER_SECTOR] = {0};
-    int err1 = sector_read(u->f, sector, data);
+    int err1 = u6fs_sector_read(u, sector, data);
 
     if(err1 < 0) return err1;
     data[inr % INODES_PER_SECTOR] = *inode;
     
-    int err2 = sector_write(u->f, sector, data);
+    int err2 = u6fs_sector_write(u, sector, data);
     return (err2 < 0) ? err2 : ERR_NONE;
 }
 
@@ -139,12 +282,42 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, const struct inode *ino
  */
 int inode_alloc(struct unix_filesystem *u){
     M_REQUIRE_NON_NULL(u);
-    uint64_t i = u->ibm->min;
-    while(i <= u->ibm->max && bm_get(u->ibm, i)){i++;};
+    int err = mountv6_bitmaps(u);
+    if(err < 0) return err;
+    return bm_alloc_next(u->ibm);
+}
+
+/**
+ * @brief alloc a new inode in the allocation group of its parent directory;
+ *        new directories go to the group with the most free inodes instead
+ *        (the parent's one on ties), so that subtrees spread over the volume
+ * @param u the filesystem (IN)
+ * @param parent the inode number of the parent directory
+ * @param mode the mode of the new inode (only IFDIR matters)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_near(struct unix_filesystem *u, uint16_t parent, uint16_t mode){
+    M_REQUIRE_NON_NULL(u);
+    int err = mountv6_bitmaps(u);
+    if(err < 0) return err;
 
-    if(i > u->ibm->max) return ERR_BITMAP_FULL;
-    bm_set(u->ibm, i);
-    return i;
+    uint32_t group = mountv6_inode_group(u, parent);
+    uint32_t first, last;
+    if(mode & IFDIR){
+        mountv6_group_inodes(u, group, &first, &last);
+        uint64_t most = bm_count_free_range(u->ibm, first, last);
+        const uint32_t n = mountv6_ngroups(u);
+        for(uint32_t g = 0; g < n; ++g){
+            mountv6_group_inodes(u, g, &first, &last);
+            const uint64_t free = bm_count_free_range(u->ibm, first, last);
+            if(free > most){
+                most = free;
+                group = g;
+            }
+        }
+    }
+    mountv6_group_inodes(u, group, &first, &last);
+    return bm_alloc_from(u->ibm, first);
 }
 
 /**
@@ -11,6 +11,25 @@
 #include "unixv6fs.h"
 #include "mount.h"
 
+#define INODE_ITER_SECTORS 16 /* sectors of the inode table read at once by inode_iter_next() */
+
+/* a run of file sectors stored in consecutive disk sectors */
+struct inode_extent {
+    int32_t file_off;                 /* first file sector of the run */
+    uint32_t sector;                  /* its location on disk */
+    uint32_t count;                   /* number of sectors of the run */
+};
+
+/* walks the allocated inodes of the inode table, in increasing order */
+struct inode_iter {
+    const struct unix_filesystem *u;  /* the filesystem */
+    uint32_t sector;                  /* next sector to read, relative to s_inode_start */
+    uint32_t first;                   /* inode number of inodes[0] */
+    size_t pos;                       /* next entry of inodes to look at */
+    size_t count;                     /* valid entries in inodes */
+    struct inode inodes[INODE_ITER_SECTORS * INODES_PER_SECTOR];
+};
+
 /**
  * @brief Return the size of a file associated to a given inode.
  *
@@ -69,6 +88,25 @@ int inode_setsize(struct inode *inode, int new_size);
  */
 int inode_scan_print(const struct unix_filesystem *u);
 
+/**
+ * @brief start a walk of the inode table (see inode_iter_next())
+ * @param u the filesystem (IN)
+ * @param it the iterator (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_iter_init(const struct unix_filesystem *u, struct inode_iter *it);
+
+/**
+ * @brief give the next allocated inode of the inode table; the table is
+ *        read INODE_ITER_SECTORS sectors at a time, so that a whole walk
+ *        reads each sector once
+ * @param it the iterator (IN-OUT)
+ * @param inr the inode number of the inode (OUT)
+ * @param inode the content of the inode (OUT)
+ * @return 1 if an inode was found; 0 at the end of the table; <0 on error
+ */
+int inode_iter_next(struct inode_iter *it, uint16_t *inr, struct inode *inode);
+
 /* *************************************************** *
  * TODO WEEK 04										   *
  * *************************************************** */
@@ -93,6 +131,21 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
  */
 int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off);
 
+/**
+ * @brief give the layout of a range of a file as runs of consecutive disk
+ *        sectors; each indirect sector is read once
+ * @param u the filesystem (IN)
+ * @param i the inode (IN)
+ * @param first the first file sector of the range
+ * @param count the number of sectors of the range (clipped to the end of the file)
+ * @param runs at most max_runs runs (OUT), in increasing file order; when
+ *        they are all used, the range may go on after the last one
+ * @param max_runs the size of runs
+ * @return the number of runs (0: the range is empty); <0 on error
+ */
+int inode_map_range(const struct unix_filesystem *u, const struct inode *i, int32_t first, int32_t count,
+                    struct inode_extent *runs, size_t max_runs);
+
 /* *************************************************** *
  * TODO WEEK 11										   *
  * *************************************************** */
@@ -103,6 +156,17 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
  */
 int inode_alloc(struct unix_filesystem *u);
 
+/**
+ * @brief alloc a new inode in the allocation group of its parent directory;
+ *        new directories go to the group with the most free inodes instead
+ *        (the parent's one on ties), so that subtrees spread over the volume
+ * @param u the filesystem (IN)
+ * @param parent the inode number of the parent directory
+ * @param mode the mode of the new inode (only IFDIR matters)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_near(struct unix_filesystem *u, uint16_t parent, uint16_t mode);
+
 /* *************************************************** *
  * TODO WEEK 11										   *
  * *************************************************** */
@@ -7,98 +7,670 @@
  */
 
 #include <string.h> // memset()
+#include <stdlib.h> // free()
 #include <inttypes.h>
+#include <fcntl.h>  // open()
+#include <pthread.h>
+#include <time.h>   // clock_gettime()
+#include <unistd.h> // sysconf(), ftruncate()
 #include "unixv6fs.h"
 #include "error.h"
 #include "mount.h"
 #include "sector.h"
 #include "bmblock.h"
 #include "inode.h"
+#include "cache.h"
+#include "icache.h"
+#include "async.h"
+
+#define MOUNTV6_SCAN_RUNS 16 /* runs of sectors asked at once to inode_map_range() */
 
 /**
- * @brief  mount a unix v6 filesystem
- * @param filename name of the unixv6 filesystem on the underlying disk (IN)
- * @param u the filesystem (OUT)
+ * @brief release everything a (partially) mounted filesystem holds, without
+ *        writing anything back
+ * @param u the filesystem
+ * @param err the error to forward
+ * @return err
+ */
+static int mountv6_abort(struct unix_filesystem *u, int err)
+{
+    icache_free(u->icache);
+    cache_free(u->cache);
+    blockdev_close(u->dev);
+    free(u->fbm);
+    free(u->ibm);
+    if (u->f != NULL) fclose(u->f);
+    memset(u, 0, sizeof(*u));
+    return err;
+}
+
+/**
+ * @brief mark in the bitmaps an allocated inode and the sectors it uses
+ * @param u the filesystem (bitmaps already allocated)
+ * @param inr the inode number
+ * @param in the content of the inode
+ */
+static void mountv6_scan_inode(struct unix_filesystem *u, size_t inr, const struct inode *in)
+{
+    if(inr < u->ibm->min || !(in->i_mode & IALLOC)) return;
+    bm_set(u->ibm, inr);
+
+    const int32_t size = inode_getsize(in);
+    const int32_t nb_sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if(size > ADDR_SMALL_LENGTH * SECTOR_SIZE
+       && size <= (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE){
+        // les secteurs d'adresses des grands fichiers
+        for(int32_t index = 0; index <= (nb_sectors - 1) / ADDRESSES_PER_SECTOR; ++index){
+            bm_set(u->fbm, in->i_addr[index]);
+        }
+    }
+    struct inode_extent runs[MOUNTV6_SCAN_RUNS];
+    int32_t offset = 0;
+    int n;
+    while((n = inode_map_range(u, in, offset, nb_sectors - offset, runs, MOUNTV6_SCAN_RUNS)) > 0){
+        for(int r = 0; r < n; ++r){
+            for(uint32_t k = 0; k < runs[r].count; ++k){
+                bm_set(u->fbm, runs[r].sector + k);
+            }
+        }
+        offset = runs[n - 1].file_off + (int32_t) runs[n - 1].count;
+    }
+}
+
+/**
+ * @brief mark in the bitmaps the allocated inodes of one sector of the inode
+ *        table, and the sectors they use; prime the inode cache with them
+ * @param u the filesystem (bitmaps already allocated)
+ * @param sector the location of the inode sector within the virtual disk
+ * @param data the content of the inode sector
+ */
+static void mountv6_scan_sector(struct unix_filesystem *u, uint32_t sector, const struct inode_sector *data)
+{
+    const size_t first = (size_t) (sector - u->s.s_inode_start) * INODES_PER_SECTOR;
+    icache_prime(u->icache, sector, data->inodes);
+    for(size_t i = 0; i < INODES_PER_SECTOR; ++i){
+        mountv6_scan_inode(u, first + i, &data->inodes[i]);
+    }
+}
+
+/**
+ * @brief build the bitmaps in a single pass over the inode table (see inode_iter_next())
+ * @param u the filesystem (bitmaps already allocated)
  * @return 0 on success; <0 on error
  */
-int mountv6(const char *filename, struct unix_filesystem *u)
+static int mountv6_scan(struct unix_filesystem *u)
+{
+    struct inode_iter it;
+    int err = inode_iter_init(u, &it);
+    if(err != ERR_NONE) return err;
+    uint16_t inr = 0;
+    struct inode in;
+    while((err = inode_iter_next(&it, &inr, &in)) > 0){
+        mountv6_scan_inode(u, inr, &in);
+    }
+    return err;
+}
+
+static int mountv6_scan_done(void *arg, uint32_t sector, void *data, int err)
+{
+    if(err == ERR_NONE){
+        mountv6_scan_sector(arg, sector, data);
+    }
+    return err;
+}
+
+/**
+ * @brief build the bitmaps, keeping ASYNC_DEFAULT_DEPTH reads of the inode
+ *        table in flight; each inode sector is processed as soon as it arrives
+ * @param u the filesystem (bitmaps already allocated)
+ * @return 0 on success; <0 on error
+ */
+static int mountv6_scan_async(struct unix_filesystem *u)
+{
+    struct async_engine *e = async_alloc(u->dev->fd, ASYNC_DEFAULT_DEPTH, 0);
+    if(e == NULL) return ERR_NOMEM;
+    int err = ERR_NONE;
+    for(uint32_t i = 0; i < u->s.s_isize && err == ERR_NONE; ++i){
+        err = async_read(e, u->s.s_inode_start + i, NULL, mountv6_scan_done, u);
+    }
+    const int err2 = async_wait(e);
+    async_free(e);
+    return err != ERR_NONE ? err : err2;
+}
+
+/* ====================================================================== *
+ * parallel rebuild                                                       *
+ * ====================================================================== */
+
+struct mountv6_worker {
+    struct unix_filesystem *u;  // only u->s and u->dev are used: the caches are not thread-safe
+    uint32_t first;             // the part of the inode table scanned: [first, end)
+    uint32_t end;               //     (in sectors, relative to s_inode_start)
+    struct bmblock_array *ibm;  // private bitmaps, ORed into u's at the end
+    struct bmblock_array *fbm;
+    pthread_t thread;
+    int err;
+};
+
+/**
+ * @brief mark in the private bitmaps of a worker an allocated inode and the
+ *        sectors it uses, reading each indirect sector once from the device;
+ *        as in mountv6_scan_inode(), the sectors past an unreadable indirect
+ *        sector are skipped
+ * @return 0 on success; <0 on error
+ */
+static int mountv6_worker_inode(struct mountv6_worker *w, size_t inr, const struct inode *in)
+{
+    if (inr < w->ibm->min || !(in->i_mode & IALLOC)) return ERR_NONE;
+    bm_set(w->ibm, inr);
+
+    const int32_t size = inode_getsize(in);
+    const int32_t nb_sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (size <= ADDR_SMALL_LENGTH * SECTOR_SIZE) {
+        for (int32_t k = 0; k < nb_sectors; ++k) bm_set(w->fbm, in->i_addr[k]);
+        return ERR_NONE;
+    }
+    // too large: no sector is reachable (as for inode_map_range())
+    if (size > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_NONE;
+
+    const int32_t nindirect = (nb_sectors - 1) / ADDRESSES_PER_SECTOR + 1;
+    for (int32_t index = 0; index < nindirect; ++index) bm_set(w->fbm, in->i_addr[index]);
+    uint16_t addresses[ADDRESSES_PER_SECTOR];
+    for (int32_t index = 0; index < nindirect; ++index) {
+        if (blockdev_read(w->u->dev, in->i_addr[index], 1, addresses) != ERR_NONE) break;
+        const int32_t left = nb_sectors - index * ADDRESSES_PER_SECTOR;
+        const int32_t n = left < ADDRESSES_PER_SECTOR ? left : ADDRESSES_PER_SECTOR;
+        for (int32_t k = 0; k < n; ++k) bm_set(w->fbm, addresses[k]);
+    }
+    return ERR_NONE;
+}
+
+static void *mountv6_worker_run(void *arg)
+{
+    struct mountv6_worker *w = arg;
+    struct inode_sector batch[INODE_ITER_SECTORS];
+    for (uint32_t s = w->first; s < w->end && w->err == ERR_NONE; s += INODE_ITER_SECTORS) {
+        const uint32_t n = w->end - s < INODE_ITER_SECTORS ? w->end - s : INODE_ITER_SECTORS;
+        w->err = blockdev_read(w->u->dev, w->u->s.s_inode_start + s, n, batch);
+        for (uint32_t i = 0; i < n && w->err == ERR_NONE; ++i) {
+            for (size_t j = 0; j < INODES_PER_SECTOR && w->err == ERR_NONE; ++j) {
+                w->err = mountv6_worker_inode(w, (size_t) (s + i) * INODES_PER_SECTOR + j, &batch[i].inodes[j]);
+            }
+        }
+    }
+    if (w->err != ERR_NONE) return NULL;
+
+    // merge while the other workers may be merging too
+    for (size_t i = 0; i < w->ibm->length; ++i) {
+        if (w->ibm->bm[i]) __atomic_fetch_or(&w->u->ibm->bm[i], w->ibm->bm[i], __ATOMIC_RELAXED);
+    }
+    for (size_t i = 0; i < w->fbm->length; ++i) {
+        if (w->fbm->bm[i]) __atomic_fetch_or(&w->u->fbm->bm[i], w->fbm->bm[i], __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * @brief build the bitmaps with worker threads, each scanning a slice of the
+ *        inode table straight from the device into private bitmaps
+ * @param u the filesystem (bitmaps already allocated and empty; nothing
+ *        written since the mount, so that the device is up to date)
+ * @return 0 on success; <0 on error
+ */
+static int mountv6_scan_parallel(struct unix_filesystem *u)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    uint32_t n = ncpu < MOUNTV6_SCAN_THREADS ? (uint32_t) ncpu : MOUNTV6_SCAN_THREADS;
+    // at least a batch of the inode iterator per worker
+    const uint32_t batches = ((uint32_t) u->s.s_isize + INODE_ITER_SECTORS - 1) / INODE_ITER_SECTORS;
+    if (n > batches) n = batches;
+    if (n == 0) return ERR_NONE;
+
+    struct mountv6_worker *workers = calloc(n, sizeof(struct mountv6_worker));
+    if (workers == NULL) return ERR_NOMEM;
+    const uint32_t slice = (batches + n - 1) / n * INODE_ITER_SECTORS;
+    int err = ERR_NONE;
+    uint32_t started = 0;
+    for (; started < n && err == ERR_NONE; ++started) {
+        struct mountv6_worker *w = &workers[started];
+        w->u = u;
+        w->first = started * slice;
+        w->end = w->first + slice < u->s.s_isize ? w->first + slice : u->s.s_isize;
+        w->ibm = bm_alloc(u->ibm->min, u->ibm->max);
+        w->fbm = bm_alloc(u->fbm->min, u->fbm->max);
+        if (w->ibm == NULL || w->fbm == NULL) {
+            err = ERR_NOMEM;
+        } else if (pthread_create(&w->thread, NULL, mountv6_worker_run, w) != 0) {
+            err = ERR_NOMEM;
+        }
+        if (err != ERR_NONE) {
+            free(w->ibm);
+            free(w->fbm);
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        if (err == ERR_NONE) err = workers[i].err;
+        free(workers[i].ibm);
+        free(workers[i].fbm);
+    }
+    free(workers);
+
+    bm_recount(u->ibm);
+    bm_recount(u->fbm);
+    return err;
+}
+
+/**
+ * @brief tell whether the bitmaps fit in the bitmap sectors of the volume,
+ *        which must lie between the superblock and the inode table, apart
+ * @param u the filesystem (bitmaps already allocated)
+ * @return non-zero if they can be saved to and loaded from disk
+ */
+static int mountv6_bitmaps_on_disk(const struct unix_filesystem *u)
+{
+    const uint32_t fbm_end = (uint32_t) u->s.s_fbm_start + u->s.s_fbmsize;
+    const uint32_t ibm_end = (uint32_t) u->s.s_ibm_start + u->s.s_ibmsize;
+    return u->s.s_fbmsize > 0 && u->s.s_ibmsize > 0 && u->s.s_fbm_start > SUPERBLOCK_SECTOR
+           && u->s.s_ibm_start > SUPERBLOCK_SECTOR
+           && fbm_end <= u->s.s_inode_start && ibm_end <= u->s.s_inode_start
+           && (fbm_end <= u->s.s_ibm_start || ibm_end <= u->s.s_fbm_start)
+           && u->fbm->length * sizeof(uint64_t) <= (size_t) u->s.s_fbmsize * SECTOR_SIZE
+           && u->ibm->length * sizeof(uint64_t) <= (size_t) u->s.s_ibmsize * SECTOR_SIZE;
+}
+
+/**
+ * @brief read a bitmap from its sectors, with one read
+ * @param u the filesystem
+ * @param bm the bitmap (OUT; its free count is recomputed)
+ * @param start the first sector of the bitmap on disk
+ * @param size the number of sectors of the bitmap on disk
+ * @return 0 on success; <0 on error
+ */
+static int mountv6_load_bitmap(struct unix_filesystem *u, struct bmblock_array *bm, uint32_t start, uint32_t size)
+{
+    uint8_t *buf = malloc((size_t) size * SECTOR_SIZE);
+    if (buf == NULL) return ERR_NOMEM;
+    int err = u6fs_sector_read_range(u, start, size, buf);
+    if (err == ERR_NONE) {
+        memcpy(bm->bm, buf, bm->length * sizeof(uint64_t));
+        bm_recount(bm);
+    }
+    free(buf);
+    return err;
+}
+
+/**
+ * @brief write a bitmap to its sectors, with one write (zero-padded)
+ * @param u the filesystem
+ * @param bm the bitmap
+ * @param start the first sector of the bitmap on disk
+ * @param size the number of sectors of the bitmap on disk
+ * @return 0 on success; <0 on error
+ */
+static int mountv6_save_bitmap(struct unix_filesystem *u, const struct bmblock_array *bm, uint32_t start, uint32_t size)
+{
+    uint8_t *buf = calloc(size, SECTOR_SIZE);
+    if (buf == NULL) return ERR_NOMEM;
+    memcpy(buf, bm->bm, bm->length * sizeof(uint64_t));
+    int err = u6fs_sector_write_range(u, start, size, buf);
+    free(buf);
+    return err;
+}
+
+/**
+ * @brief make sure the bitmaps of a mounted filesystem are there: load them
+ *        from a clean filesystem, build them from the inode table otherwise
+ *        (with MOUNTV6_ASYNC, as mountv6() does); nothing to do unless it
+ *        was mounted with MOUNTV6_LAZY
+ * @param u the mounted filesystem
+ * @return 0 on success; <0 on error (the bitmaps stay NULL)
+ */
+int mountv6_bitmaps(struct unix_filesystem *u)
 {
-    M_REQUIRE_NON_NULL(filename);
     M_REQUIRE_NON_NULL(u);
-    memset(u, 0, sizeof(*u));
-    u->f = fopen(filename, "rb+");
-    if (u->f == NULL) return ERR_IO;
-    
+    if (u->ibm != NULL && u->fbm != NULL) return ERR_NONE;
+    if (u->dev == NULL) return ERR_IO;
+
+    u->ibm = bm_alloc(ROOT_INUMBER, u->s.s_isize * INODES_PER_SECTOR);
+    u->fbm = bm_alloc(u->s.s_block_start, u->s.s_fsize);
+    int err = u->ibm != NULL && u->fbm != NULL ? ERR_NONE : ERR_NOMEM;
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char *how = "loaded";
+    if (err == ERR_NONE) {
+        if (u->s.s_fmod == MOUNTV6_FMOD_CLEAN && mountv6_bitmaps_on_disk(u)) {
+            // a few sequential reads instead of the whole inode table
+            err = mountv6_load_bitmap(u, u->ibm, u->s.s_ibm_start, u->s.s_ibmsize);
+            if (err == ERR_NONE) {
+                err = mountv6_load_bitmap(u, u->fbm, u->s.s_fbm_start, u->s.s_fbmsize);
+            }
+        } else if (!u->written && ((u->flags & MOUNTV6_PARALLEL) || u->s.s_isize >= MOUNTV6_PARALLEL_MIN)) {
+            // the workers read the device: only while the caches hold nothing newer
+            how = "rebuilt in parallel";
+            err = mountv6_scan_parallel(u);
+        } else if ((u->flags & MOUNTV6_ASYNC) && u->dev->fd >= 0) {
+            how = "rebuilt asynchronously";
+            err = mountv6_scan_async(u);
+        } else {
+            how = "rebuilt";
+            err = mountv6_scan(u);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    u->bitmaps_ns = (uint64_t) (stop.tv_sec - start.tv_sec) * 1000000000u + (uint64_t) stop.tv_nsec
+                    - (uint64_t) start.tv_nsec;
+    debug_printf("bitmaps %s in %" PRIu64 " us\n", how, u->bitmaps_ns / 1000);
+    (void) how; // without DEBUG
+
+    if (err != ERR_NONE) {
+        free(u->ibm);
+        free(u->fbm);
+        u->ibm = u->fbm = NULL;
+    }
+    return err;
+}
+
+/**
+ * @brief read the superblock of a filesystem whose device is set, switch to
+ *        the memory device requested by the options, then build the bitmaps
+ * @param u the filesystem (IN-OUT)
+ * @param opts the mount options (IN)
+ * @return 0 on success; <0 on error (u is then released)
+ */
+static int mountv6_setup(struct unix_filesystem *u, const struct mountv6_options *opts)
+{
     char data[SECTOR_SIZE];
-    int err = sector_read(u->f, BOOTBLOCK_SECTOR, data);
+    int err = u6fs_sector_read(u, BOOTBLOCK_SECTOR, data);
     if (err == ERR_NONE) {
         if (data[BOOTBLOCK_MAGIC_NUM_OFFSET] != BOOTBLOCK_MAGIC_NUM){
-            fclose(u->f);
-            return ERR_BAD_BOOT_SECTOR;
+            return mountv6_abort(u, ERR_BAD_BOOT_SECTOR);
         }
         else{
             struct superblock superblock_copy = {0};
             struct superblock *data1 = &superblock_copy;
-            int err1 = sector_read(u->f, SUPERBLOCK_SECTOR, data1);
+            int err1 = u6fs_sector_read(u, SUPERBLOCK_SECTOR, data1);
             if (err1 == ERR_NONE){
                 u->s = *data1;
 
-                u->ibm = bm_alloc(ROOT_INUMBER, u->s.s_isize * INODES_PER_SECTOR);
-                if (u->ibm == NULL) {
-                    fclose(u->f);
-                    return ERR_NOMEM;
+                if ((opts->flags & (MOUNTV6_MMAP | MOUNTV6_RAM)) && u->dev->fd >= 0) {
+                    const int rdonly = (opts->flags & MOUNTV6_RDONLY) != 0;
+                    struct blockdev *mem = (opts->flags & MOUNTV6_MMAP)
+                                           ? blockdev_mmap(u->dev->fd, u->s.s_fsize, rdonly)
+                                           : blockdev_ram(u->dev->fd, u->s.s_fsize, rdonly);
+                    if (mem == NULL) return mountv6_abort(u, ERR_IO);
+                    blockdev_close(u->dev);
+                    u->dev = mem;
+                }
+
+                // memory devices need no sector nor inode cache
+                if (opts->cache_size > 0 && u->dev->mem == NULL) {
+                    u->cache = cache_alloc(u->dev, opts->cache_size, opts->flags & MOUNTV6_WRITEBACK);
+                    if (u->cache == NULL) return mountv6_abort(u, ERR_NOMEM);
                 }
-                    
-                u->fbm = bm_alloc(u->s.s_block_start, u->s.s_fsize);
-                if (u->fbm == NULL) {
-                    fclose(u->f);
-                    return ERR_NOMEM;
+                if (opts->icache_size > 0 && u->dev->mem == NULL) {
+                    u->icache = icache_alloc(u, opts->icache_size, opts->flags & MOUNTV6_WRITEBACK);
+                    if (u->icache == NULL) return mountv6_abort(u, ERR_NOMEM);
                 }
-            
-                struct inode in;
-                memset(&in, 0, sizeof(struct inode));
-                for(size_t i = u->ibm->min; i < u->ibm->max; ++i){
-                    int res = inode_read(u, i, &in);
-                    if(res != ERR_UNALLOCATED_INODE){
-                        bm_set(u->ibm, i);
-                        int sector;
-                        int offset = 0;
-                        while((sector = inode_findsector(u, &in, offset)) > 0){
-                            //Dans le cas ou on a un petit fichier 
-                            //in.iaddr[offset/ADRESSES_PER_SECTOR] 
-                            //sera simplement egale a sector
-                            bm_set(u->fbm, in.i_addr[offset / ADDRESSES_PER_SECTOR]);
-                            bm_set(u->fbm, sector);
-                            offset++;
-                        }
-                    }
+
+                if (!(opts->flags & MOUNTV6_LAZY)) {
+                    int err2 = mountv6_bitmaps(u);
+                    if(err2 != ERR_NONE) return mountv6_abort(u, err2);
                 }
 
                 return ERR_NONE;
             }
             else{
-                fclose(u->f);
-                return err1;
+                return mountv6_abort(u, err1);
             }
         }
     }
     else{
-        fclose(u->f);
-        return err;
+        return mountv6_abort(u, err);
     }
 }
 
+/**
+ * @brief  mount a unix v6 filesystem
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @return 0 on success; <0 on error
+ */
+int mountv6(const char *filename, struct unix_filesystem *u)
+{
+    const struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    return mountv6_opt(filename, u, &opts);
+}
+
+/**
+ * @brief  mount a unix v6 filesystem with the given options
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @param opts the mount options (IN)
+ * @return 0 on success; <0 on error
+ */
+int mountv6_opt(const char *filename, struct unix_filesystem *u, const struct mountv6_options *opts)
+{
+    M_REQUIRE_NON_NULL(filename);
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(opts);
+    memset(u, 0, sizeof(*u));
+    u->flags = opts->flags;
+    u->f = fopen(filename, (opts->flags & MOUNTV6_RDONLY) ? "rb" : "rb+");
+    if (u->f == NULL) return ERR_IO;
+    // every sector I/O is positional on the descriptor: f is never read nor written
+    u->fd = fileno(u->f);
+    u->dev = blockdev_file(u->fd);
+    if (u->dev == NULL) return mountv6_abort(u, ERR_NOMEM);
+
+    return mountv6_setup(u, opts);
+}
+
+/**
+ * @brief  mount the unix v6 filesystem held by a block device (e.g. a RAM disk)
+ * @param dev the device, owned by the filesystem from now on, even on error:
+ *        umountv6() flushes and closes it
+ * @param u the filesystem (OUT)
+ * @param opts the mount options (IN)
+ * @return 0 on success; <0 on error
+ */
+int mountv6_dev(struct blockdev *dev, struct unix_filesystem *u, const struct mountv6_options *opts)
+{
+    M_REQUIRE_NON_NULL(u);
+    memset(u, 0, sizeof(*u));
+    if (dev == NULL) return ERR_BAD_PARAMETER;
+    u->dev = dev;
+    u->fd = -1;
+    if (opts == NULL) return mountv6_abort(u, ERR_BAD_PARAMETER);
+    u->flags = opts->flags;
+
+    return mountv6_setup(u, opts);
+}
 
 int umountv6(struct unix_filesystem *u)
 {
     if (u == NULL){
         return ERR_BAD_PARAMETER;
-    }else if (u->f == NULL || fclose(u->f)){
+    }else if (u->dev == NULL){
         return ERR_IO;
     }else{
+        int err = ERR_NONE;
+        // lazily mounted and written: the bitmaps are needed to leave it clean
+        if (u->written && !(u->flags & MOUNTV6_RDONLY) && u->s.s_fbmsize > 0 && u->s.s_ibmsize > 0) {
+            err = mountv6_bitmaps(u);
+        }
+        // the inodes go to the sector cache first, then everything to the device
+        if (u->icache != NULL) {
+            const int err1 = icache_flush(u->icache);
+            if (err == ERR_NONE) err = err1;
+#ifdef DEBUG
+            icache_print_stats(u->icache);
+#endif
+            icache_free(u->icache);
+        }
+        // the bitmaps are saved with the rest, the superblock says so once it is all on disk
+        const int save = err == ERR_NONE && u->written && !(u->flags & MOUNTV6_RDONLY)
+                         && u->fbm != NULL && u->ibm != NULL && mountv6_bitmaps_on_disk(u);
+        if (save) {
+            err = mountv6_save_bitmap(u, u->ibm, u->s.s_ibm_start, u->s.s_ibmsize);
+            if (err == ERR_NONE) err = mountv6_save_bitmap(u, u->fbm, u->s.s_fbm_start, u->s.s_fbmsize);
+        }
+        if (u->cache != NULL) {
+            const int err1 = cache_flush(u->cache);
+            if (err == ERR_NONE) err = err1;
+#ifdef DEBUG
+            cache_print_stats(u->cache);
+#endif
+            cache_free(u->cache);
+        }
+        if (save && err == ERR_NONE) {
+            // past the cache (freed): it may hold the superblock marked dirty
+            u->s.s_fmod = MOUNTV6_FMOD_CLEAN;
+            err = blockdev_flush(u->dev);
+            if (err == ERR_NONE) err = blockdev_write(u->dev, SUPERBLOCK_SECTOR, 1, &u->s);
+        }
+        const int err2 = blockdev_flush(u->dev);
+        if (err == ERR_NONE) err = err2;
+        blockdev_close(u->dev);
+        if (u->f != NULL && fclose(u->f) && err == ERR_NONE) err = ERR_IO;
         free(u->fbm);
         free(u->ibm);
         memset(u, 0, sizeof(*u));
-        return ERR_NONE;
+        return err;
+    }
+}
+
+/* ====================================================================== *
+ * allocation groups                                                      *
+ * ====================================================================== */
+
+uint32_t mountv6_ngroups(const struct unix_filesystem *u)
+{
+    if (u == NULL || u->fbm == NULL || u->ibm == NULL) return 1;
+    const uint64_t nsectors = u->fbm->max - u->fbm->min + 1;
+    const uint64_t ninodes = u->ibm->max - u->ibm->min + 1;
+    uint64_t n = (nsectors + MOUNTV6_GROUP_SECTORS - 1) / MOUNTV6_GROUP_SECTORS;
+    // every group must have inodes
+    if (n > ninodes) n = ninodes;
+    return n > 0 ? (uint32_t) n : 1;
+}
+
+/**
+ * @brief number of values of a bitmap per group (the last group may be shorter)
+ */
+static uint64_t mountv6_group_span(const struct bmblock_array *bm, uint32_t ngroups)
+{
+    return (bm->max - bm->min + ngroups) / ngroups;
+}
+
+uint32_t mountv6_inode_group(const struct unix_filesystem *u, uint16_t inr)
+{
+    const uint32_t n = mountv6_ngroups(u);
+    if (n == 1 || inr < u->ibm->min) return 0;
+    const uint64_t g = (inr - u->ibm->min) / mountv6_group_span(u->ibm, n);
+    return g < n ? (uint32_t) g : n - 1;
+}
+
+uint32_t mountv6_sector_group(const struct unix_filesystem *u, uint32_t sector)
+{
+    const uint32_t n = mountv6_ngroups(u);
+    if (n == 1 || sector < u->fbm->min) return 0;
+    const uint64_t g = (sector - u->fbm->min) / mountv6_group_span(u->fbm, n);
+    return g < n ? (uint32_t) g : n - 1;
+}
+
+void mountv6_group_inodes(const struct unix_filesystem *u, uint32_t g, uint32_t *first, uint32_t *last)
+{
+    if (first == NULL || last == NULL) return;
+    if (u == NULL || u->ibm == NULL) {
+        *first = *last = 0;
+        return;
+    }
+    const uint32_t n = mountv6_ngroups(u);
+    const uint64_t span = mountv6_group_span(u->ibm, n);
+    if (g >= n) g = n - 1;
+    *first = (uint32_t) (u->ibm->min + g * span);
+    *last = g + 1 == n ? (uint32_t) u->ibm->max : (uint32_t) (u->ibm->min + (g + 1) * span - 1);
+}
+
+uint32_t mountv6_group_first_sector(const struct unix_filesystem *u, uint32_t g)
+{
+    if (u == NULL || u->fbm == NULL) return 0;
+    const uint32_t n = mountv6_ngroups(u);
+    if (g >= n) g = n - 1;
+    return (uint32_t) (u->fbm->min + g * mountv6_group_span(u->fbm, n));
+}
+
+/* ====================================================================== *
+ * mkfs                                                                   *
+ * ====================================================================== */
+
+/**
+ * @brief number of sectors needed to hold a bitmap of [min, max] on disk
+ *        (as written by umountv6())
+ */
+static uint16_t mountv6_bitmap_sectors(uint64_t min, uint64_t max)
+{
+    const size_t bytes = ((max - min) / 64 + 1) * sizeof(uint64_t);
+    return (uint16_t) ((bytes + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
+{
+    M_REQUIRE_NON_NULL(filename);
+
+    struct superblock s;
+    memset(&s, 0, sizeof(struct superblock));
+    // boot sector, superblock, bitmaps, inode table, data
+    s.s_isize = (uint16_t) ((num_inodes + INODES_PER_SECTOR - 1) / INODES_PER_SECTOR);
+    // the inode bitmap goes up to s_isize * INODES_PER_SECTOR: keep it a uint16_t
+    if (s.s_isize > UINT16_MAX / INODES_PER_SECTOR) s.s_isize = UINT16_MAX / INODES_PER_SECTOR;
+    s.s_fsize = num_blocks;
+    s.s_fbm_start = SUPERBLOCK_SECTOR + 1;
+    s.s_fbmsize = mountv6_bitmap_sectors(0, num_blocks);
+    s.s_ibm_start = (uint16_t) (s.s_fbm_start + s.s_fbmsize);
+    s.s_ibmsize = mountv6_bitmap_sectors(ROOT_INUMBER, (uint64_t) s.s_isize * INODES_PER_SECTOR);
+    const uint32_t inode_start = (uint32_t) s.s_ibm_start + s.s_ibmsize;
+    const uint32_t block_start = inode_start + s.s_isize;
+    if (num_inodes == 0 || block_start >= num_blocks) {
+        return ERR_BAD_PARAMETER;
+    }
+    s.s_inode_start = (uint16_t) inode_start;
+    s.s_block_start = (uint16_t) block_start;
+    // the bitmaps written below are exact: mountv6() loads them
+    s.s_fmod = MOUNTV6_FMOD_CLEAN;
+
+    struct bmblock_array *ibm = bm_alloc(ROOT_INUMBER, (uint64_t) s.s_isize * INODES_PER_SECTOR);
+    struct bmblock_array *fbm = bm_alloc(s.s_block_start, s.s_fsize);
+    // everything up to the first inode-table sector (root inode), in one write
+    uint8_t *meta = calloc(inode_start + 1, SECTOR_SIZE);
+    int err = ibm != NULL && fbm != NULL && meta != NULL ? ERR_NONE : ERR_NOMEM;
+    if (err == ERR_NONE) {
+        meta[BOOTBLOCK_MAGIC_NUM_OFFSET] = BOOTBLOCK_MAGIC_NUM;
+        memcpy(meta + SUPERBLOCK_SECTOR * SECTOR_SIZE, &s, sizeof(struct superblock));
+
+        // as mountv6_bitmaps() would rebuild them: only the root directory, empty
+        bm_set(ibm, ROOT_INUMBER);
+        memcpy(meta + (size_t) s.s_fbm_start * SECTOR_SIZE, fbm->bm, fbm->length * sizeof(uint64_t));
+        memcpy(meta + (size_t) s.s_ibm_start * SECTOR_SIZE, ibm->bm, ibm->length * sizeof(uint64_t));
+
+        struct inode *inodes = (struct inode *) (meta + (size_t) inode_start * SECTOR_SIZE);
+        inodes[ROOT_INUMBER].i_mode = IALLOC | IFDIR | IREAD | IWRITE | IEXEC;
+
+        const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            err = ERR_IO;
+        } else {
+            // sparse: the rest of the inode table and the data are holes
+            if (ftruncate(fd, (off_t) num_blocks * SECTOR_SIZE) != 0) err = ERR_IO;
+            if (err == ERR_NONE) err = sector_pwrite_range(fd, 0, inode_start + 1, meta);
+            if (close(fd) != 0 && err == ERR_NONE) err = ERR_IO;
+        }
     }
+    free(meta);
+    free(ibm);
+    free(fbm);
+    return err;
 }
@@ -11,14 +11,65 @@
 #include <stdio.h>
 #include "unixv6fs.h"
 #include "bmblock.h"
+#include "cache.h"
+#include "icache.h"
+#include "blockdev.h"
 
 struct unix_filesystem {
-    FILE *f;
+    FILE *f;                       /* the image (NULL when mounted with mountv6_dev()) */
+    int fd;                        /* descriptor of f (-1 without f) */
+    struct blockdev *dev;          /* where the sectors are read from and written to */
     struct superblock s;           /* copy of the superblock */
-    struct bmblock_array *fbm;     /* block bitmap -- ignore before WEEK 10 */
-    struct bmblock_array *ibm;     /* inode bitmap  -- ignore before WEEK 10 */
+    struct bmblock_array *fbm;     /* block bitmap -- ignore before WEEK 10 (NULL until mountv6_bitmaps()) */
+    struct bmblock_array *ibm;     /* inode bitmap  -- ignore before WEEK 10 (NULL until mountv6_bitmaps()) */
+    struct sector_cache *cache;    /* write-back sector cache (NULL: uncached) */
+    struct inode_cache *icache;    /* inode cache (NULL: inodes read from their sector) */
+    int flags;                     /* MOUNTV6_* flags the filesystem was mounted with */
+    int written;                   /* a sector was written since the mount */
+    uint64_t bitmaps_ns;           /* time spent loading or rebuilding the bitmaps */
 };
 
+/* mount flags */
+#define MOUNTV6_WRITEBACK  0x1     /* defer sector and inode writes until eviction/umountv6() */
+#define MOUNTV6_RDONLY     0x2     /* refuse every sector write */
+#define MOUNTV6_MMAP       0x4     /* map the image in memory instead of reading it through f
+                                    * (PROT_READ only, thus shareable, with MOUNTV6_RDONLY);
+                                    * the sector and inode caches are then useless and not allocated */
+#define MOUNTV6_ASYNC      0x8     /* read the inode table through the async engine (io_uring
+                                    * when available) to build the bitmaps; only on file devices */
+#define MOUNTV6_RAM        0x10    /* load the whole image into memory (RAM disk), saved back
+                                    * by umountv6() unless MOUNTV6_RDONLY; no sector nor inode cache either */
+#define MOUNTV6_LAZY       0x20    /* only read the superblock: the bitmaps are built (or loaded) by
+                                    * mountv6_bitmaps(), on the first allocation */
+#define MOUNTV6_PARALLEL   0x40    /* rebuild the bitmaps with worker threads, each scanning a part of
+                                    * the inode table (done anyway for tables of at least
+                                    * MOUNTV6_PARALLEL_MIN sectors, unless something was written) */
+
+#define MOUNTV6_PARALLEL_MIN 256    /* inode sectors (4096 inodes) */
+#define MOUNTV6_SCAN_THREADS 8      /* at most, and at most one per CPU */
+
+/* s_fmod of a filesystem whose bitmap sectors (s_fbm_start, s_ibm_start)
+ * match its inodes, as left by umountv6(): mountv6() then loads them instead
+ * of scanning the inode table. The first write of a mount sets s_fmod to 1;
+ * any value but MOUNTV6_FMOD_CLEAN (e.g. the 0 of older images) means that
+ * the bitmaps must be rebuilt */
+#define MOUNTV6_FMOD_CLEAN 0xC1
+
+struct mountv6_options {
+    size_t cache_size;             /* sector cache budget in bytes; 0 disables the cache */
+    size_t icache_size;            /* inode cache budget in bytes; 0 disables the cache */
+    int flags;                     /* MOUNTV6_* flags */
+};
+
+/* write-through by default: the image on disk is always up to date */
+#define MOUNTV6_DEFAULT_OPTIONS { .cache_size = CACHE_DEFAULT_SIZE, .icache_size = ICACHE_DEFAULT_SIZE, .flags = 0 }
+
+/* allocation groups, as the cylinder groups of FFS: the data zone is cut
+ * into groups of MOUNTV6_GROUP_SECTORS sectors, the inodes into as many
+ * groups, and new inodes and sectors are placed in the group of what they
+ * belong with (so that a directory and its files stay close) */
+#define MOUNTV6_GROUP_SECTORS 2048 /* 1 MB of data per group */
+
 
 /* *************************************************** *
  * TODO WEEK 04: Implement							   *
@@ -32,22 +83,100 @@ struct unix_filesystem {
  */
 int mountv6(const char *filename, struct unix_filesystem *u);
 
+/**
+ * @brief  mount a unix v6 filesystem with the given options
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @param opts the mount options (IN)
+ * @return 0 on success; <0 on error
+ */
+int mountv6_opt(const char *filename, struct unix_filesystem *u, const struct mountv6_options *opts);
+
+/**
+ * @brief  mount the unix v6 filesystem held by a block device (e.g. a RAM disk)
+ * @param dev the device, owned by the filesystem from now on, even on error:
+ *        umountv6() flushes and closes it
+ * @param u the filesystem (OUT)
+ * @param opts the mount options (IN); MOUNTV6_MMAP and MOUNTV6_RAM only
+ *        apply to file devices
+ * @return 0 on success; <0 on error
+ */
+int mountv6_dev(struct blockdev *dev, struct unix_filesystem *u, const struct mountv6_options *opts);
+
 
 /* *************************************************** *
  * TODO WEEK 04: Implement							   *
  * TODO WEEK 10: Add bitmaps					   	   *
  * *************************************************** */
 /**
- * @brief unmount the given filesystem
+ * @brief unmount the given filesystem (writing back the dirty cached sectors);
+ *        if anything was written and the volume has bitmap sectors, save the
+ *        bitmaps there and mark the filesystem clean (see MOUNTV6_FMOD_CLEAN)
  * @param u - the mounted filesytem
  * @return 0 on success; <0 on error
  */
 int umountv6(struct unix_filesystem *u);
 
 /**
- * @brief create a new filesystem
+ * @brief make sure the bitmaps of a mounted filesystem are there: load them
+ *        from a clean filesystem, build them from the inode table otherwise
+ *        (with MOUNTV6_ASYNC, as mountv6() does); nothing to do unless it
+ *        was mounted with MOUNTV6_LAZY
+ * @param u the mounted filesystem
+ * @return 0 on success; <0 on error (the bitmaps stay NULL)
+ */
+int mountv6_bitmaps(struct unix_filesystem *u);
+
+/**
+ * @brief give the number of allocation groups of a mounted filesystem
+ * @param u the filesystem
+ * @return the number of groups (at least 1)
+ */
+uint32_t mountv6_ngroups(const struct unix_filesystem *u);
+
+/**
+ * @brief give the allocation group of an inode
+ * @param u the filesystem
+ * @param inr the inode number
+ * @return the group
+ */
+uint32_t mountv6_inode_group(const struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief give the allocation group of a data sector
+ * @param u the filesystem
+ * @param sector the location (in sector units) of the sector
+ * @return the group
+ */
+uint32_t mountv6_sector_group(const struct unix_filesystem *u, uint32_t sector);
+
+/**
+ * @brief give the inodes of an allocation group
+ * @param u the filesystem
+ * @param g the group
+ * @param first the first inode of the group (OUT)
+ * @param last the last inode of the group (OUT)
+ */
+void mountv6_group_inodes(const struct unix_filesystem *u, uint32_t g, uint32_t *first, uint32_t *last);
+
+/**
+ * @brief give the first data sector of an allocation group
+ * @param u the filesystem
+ * @param g the group
+ * @return the location (in sector units) of the sector
+ */
+uint32_t mountv6_group_first_sector(const struct unix_filesystem *u, uint32_t g);
+
+/**
+ * @brief create a new filesystem, with an empty root directory: its bitmaps
+ *        follow the superblock, then come the inode table and the data. The
+ *        image is sparse (only the sectors up to the root inode are written,
+ *        with a single write), and clean: mountv6() loads its bitmaps
+ * @param filename the image to create (overwritten if it exists)
  * @param num_blocks the total number of blocks (= max size of disk), in sectors
- * @param num_inodes the total number of inodes
+ * @param num_inodes the total number of inodes (rounded up to a whole sector
+ *        of inodes, but at most UINT16_MAX / INODES_PER_SECTOR sectors)
+ * @return 0 on success; <0 on error (ERR_BAD_PARAMETER if the volume is too small)
  */
 int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes);
 
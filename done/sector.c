@@ -1,10 +1,16 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h> // pread(), pwrite()
+#include <sys/uio.h> // preadv(), pwritev()
 #include "unixv6fs.h"
 #include "sector.h"
 #include "error.h"
 #include "mount.h"
 #include "bmblock.h"
+#include "cache.h"
+#include "blockdev.h"
 /**
  * @file  sector.c
  * @brief block-level accessor function.
@@ -12,31 +18,199 @@
  * @date spring 2023
  */
 
+/**
+ * @brief transfer whole sectors at their position in the virtual disk,
+ *        without using (nor moving) any shared file cursor; interrupted and
+ *        partial transfers are resumed
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) of the first sector
+ * @param data a pointer to len bytes of memory
+ * @param len the number of bytes to transfer (a multiple of SECTOR_SIZE)
+ * @param write 0 to read the sectors into data, 1 to write data into the sectors
+ * @return 0 on success; ERR_IO if the system call fails or if the end of the
+ *         file is reached before the end of the last sector
+ */
+static int sector_transfer(int fd, uint32_t sector, void *data, size_t len, int write){
+    const off_t offset = (off_t) sector * SECTOR_SIZE;
+    size_t done = 0;
+    while(done < len){
+        ssize_t n = write ? pwrite(fd, (char *) data + done, len - done, offset + (off_t) done)
+                          : pread(fd, (char *) data + done, len - done, offset + (off_t) done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return ERR_IO;
+        done += (size_t) n;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief transfer a run of consecutive sectors from/to separate buffers with
+ *        a single preadv()/pwritev() (resumed if interrupted or partial)
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) of the first sector
+ * @param iov one SECTOR_SIZE entry per sector (IN-OUT: consumed while transferring)
+ * @param iovcnt the number of sectors of the run
+ * @param write 0 to read, 1 to write
+ * @return 0 on success; ERR_IO on failed or short transfer
+ */
+static int sector_transferv(int fd, uint32_t sector, struct iovec *iov, int iovcnt, int write){
+    off_t offset = (off_t) sector * SECTOR_SIZE;
+    while(iovcnt > 0){
+        ssize_t n = write ? pwritev(fd, iov, iovcnt, offset) : preadv(fd, iov, iovcnt, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return ERR_IO;
+        offset += n;
+        while(iovcnt > 0 && (size_t) n >= iov->iov_len){
+            n -= (ssize_t) iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief transfer a scatter list of sectors, with one system call per run of
+ *        consecutive sectors (at most SECTOR_IOV_MAX sectors per call)
+ * @param fd file descriptor of the virtual disk
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory
+ * @param n the number of sectors
+ * @param write 0 to read, 1 to write
+ * @return 0 on success; <0 on error
+ */
+static int sector_scatter(int fd, const uint32_t *sectors, void *const *bufs, size_t n, int write){
+    struct iovec iov[SECTOR_IOV_MAX];
+    size_t i = 0;
+    while(i < n){
+        int len = 0;
+        do{
+            iov[len].iov_base = bufs[i + (size_t) len];
+            iov[len].iov_len = SECTOR_SIZE;
+            ++len;
+        }while(i + (size_t) len < n && len < SECTOR_IOV_MAX
+               && sectors[i + (size_t) len] == sectors[i] + (uint32_t) len);
+        int err = len == 1 ? sector_transfer(fd, sectors[i], bufs[i], SECTOR_SIZE, write)
+                           : sector_transferv(fd, sectors[i], iov, len, write);
+        if(err != ERR_NONE) return err;
+        i += (size_t) len;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief read one 512-byte sector from the virtual disk, at its position
+ *        (thread-safe: no file cursor is involved)
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_pread(int fd, uint32_t sector, void *data){
+    M_REQUIRE_NON_NULL(data);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    return sector_transfer(fd, sector, data, SECTOR_SIZE, 0);
+}
+
+/**
+ * @brief write one 512-byte sector to the virtual disk, at its position
+ *        (thread-safe: no file cursor is involved)
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int sector_pwrite(int fd, uint32_t sector, const void *data){
+    M_REQUIRE_NON_NULL(data);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    // sector_transfer() does not write into data when writing
+    return sector_transfer(fd, sector, (void *) (uintptr_t) data, SECTOR_SIZE, 1);
+}
+
+/**
+ * @brief read count consecutive sectors into one buffer, with a single
+ *        positional read
+ * @param fd file descriptor of the virtual disk
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to read
+ * @param data a pointer to count * 512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short read)
+ */
+int sector_pread_range(int fd, uint32_t first, uint32_t count, void *data){
+    M_REQUIRE_NON_NULL(data);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    return sector_transfer(fd, first, data, (size_t) count * SECTOR_SIZE, 0);
+}
+
+/**
+ * @brief write count consecutive sectors from one buffer, with a single
+ *        positional write
+ * @param fd file descriptor of the virtual disk
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to write
+ * @param data a pointer to count * 512 bytes of memory (IN)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short write)
+ */
+int sector_pwrite_range(int fd, uint32_t first, uint32_t count, const void *data){
+    M_REQUIRE_NON_NULL(data);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    return sector_transfer(fd, first, (void *) (uintptr_t) data, (size_t) count * SECTOR_SIZE, 1);
+}
+
+/**
+ * @brief read a scatter list of sectors; each run of consecutive sectors is
+ *        read with a single preadv()
+ * @param fd file descriptor of the virtual disk
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_preadv(int fd, const uint32_t *sectors, void *const *bufs, size_t n){
+    if(n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    return sector_scatter(fd, sectors, bufs, n, 0);
+}
+
+/**
+ * @brief write a scatter list of sectors; each run of consecutive sectors is
+ *        written with a single pwritev()
+ * @param fd file descriptor of the virtual disk
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_pwritev(int fd, const uint32_t *sectors, const void *const *bufs, size_t n){
+    if(n == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(bufs);
+    if(fd < 0) return ERR_BAD_PARAMETER;
+    // sector_scatter() does not write into the buffers when writing
+    return sector_scatter(fd, sectors, (void *const *) (uintptr_t) bufs, n, 1);
+}
+
 /**
  * @brief read one 512-byte sector from the virtual disk
  * @param f open file of the virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (OUT)
- * @return 0 on success; #include "sector.h"0 on error
+ * @return 0 on success; <0 on error
  */
 int sector_read(FILE *f, uint32_t sector, void *data){
     /*checking if file f is not NULL*/
     M_REQUIRE_NON_NULL(f);
     M_REQUIRE_NON_NULL(data);
 
-    /*starting at the right sector*/
-    int success = fseek(f, sector * SECTOR_SIZE, SEEK_SET);
-    if(success == 0){
-        if(fread(data, SECTOR_SIZE, 1, f) == 1){
-            return ERR_NONE;
-        }
-        else{
-            return ERR_IO;
-        }
-    }
-    else{
-        return ERR_IO;
-    }
+    /*pending stdio writes on f must reach the file before reading under it*/
+    if(fflush(f) != 0) return ERR_IO;
+    return sector_pread(fileno(f), sector, data);
 }
 
 /**
@@ -49,12 +223,208 @@ int sector_read(FILE *f, uint32_t sector, void *data){
 int sector_write(FILE *f, uint32_t sector, const void *data){
     M_REQUIRE_NON_NULL(f);
     M_REQUIRE_NON_NULL(data);
-    
-    int success = fseek(f, sector * SECTOR_SIZE, SEEK_SET);
-    if(success == 0){
-        if(fwrite(data, SECTOR_SIZE, 1, f) == 1){
-            return ERR_NONE;
-        }else return ERR_IO;
-    }else return ERR_IO;
+
+    if(fflush(f) != 0) return ERR_IO;
+    return sector_pwrite(fileno(f), sector, data);
 }
 
+/**
+ * @brief read one 512-byte sector of a mounted filesystem, through its
+ *        sector cache when it has one
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_read(const struct unix_filesystem *u, uint32_t sector, void *data){
+    M_REQUIRE_NON_NULL(u);
+    if(u->cache != NULL){
+        return cache_read(u->cache, sector, data);
+    }
+    return blockdev_read(u->dev, sector, 1, data);
+}
+
+/**
+ * @brief give access to one 512-byte sector of a mounted filesystem without
+ *        copying it when the device is in memory; otherwise the sector is
+ *        read (see u6fs_sector_read()) into buf
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param buf a pointer to 512-bytes of memory, only used if the device is not in memory
+ * @param data set to the content of the sector, i.e. into the device or buf (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_get(const struct unix_filesystem *u, uint32_t sector, void *buf, const void **data){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(data);
+    if(u->dev != NULL && u->dev->mem != NULL && u->cache == NULL){
+        if((size_t) sector >= u->dev->mem_size / SECTOR_SIZE) return ERR_IO;
+        *data = u->dev->mem + (size_t) sector * SECTOR_SIZE;
+        return ERR_NONE;
+    }
+    M_REQUIRE_NON_NULL(buf);
+    *data = buf;
+    return u6fs_sector_read(u, sector, buf);
+}
+
+/**
+ * @brief note that a mounted filesystem is being written; the first time, if
+ *        it was clean, mark it dirty on disk first, since its bitmap sectors
+ *        are stale until umountv6() saves them again. The marker goes to the
+ *        device past the sector cache, before any other sector may leave it
+ * @param u the mounted filesystem
+ * @return 0 on success; <0 on error
+ */
+static int u6fs_sector_dirty(struct unix_filesystem *u){
+    if(u->written) return ERR_NONE;
+    u->written = 1;
+    if(u->s.s_fmod != MOUNTV6_FMOD_CLEAN) return ERR_NONE;
+    u->s.s_fmod = 1;
+    int err = blockdev_write(u->dev, SUPERBLOCK_SECTOR, 1, &u->s);
+    if(err == ERR_NONE) err = blockdev_flush(u->dev);
+    // the cached superblock, if any, still says clean
+    cache_invalidate(u->cache, SUPERBLOCK_SECTOR);
+    if(err != ERR_NONE){
+        u->s.s_fmod = MOUNTV6_FMOD_CLEAN;
+        u->written = 0;
+    }
+    return err;
+}
+
+/**
+ * @brief write one 512-byte sector of a mounted filesystem, through its
+ *        sector cache when it has one
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_write(struct unix_filesystem *u, uint32_t sector, const void *data){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(data);
+    if(u->flags & MOUNTV6_RDONLY) return ERR_IO;
+    int err = u6fs_sector_dirty(u);
+    if(err != ERR_NONE) return err;
+    if(u->cache != NULL){
+        return cache_write(u->cache, sector, data);
+    }
+    return blockdev_write(u->dev, sector, 1, data);
+}
+
+/**
+ * @brief read a scatter list of sectors of a mounted filesystem: sectors
+ *        found in the cache are copied, the others are fetched from the
+ *        device together
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_readv(const struct unix_filesystem *u, const uint32_t *sectors, void *const *bufs, size_t n){
+    M_REQUIRE_NON_NULL(u);
+    if(u->cache != NULL){
+        return cache_readv(u->cache, sectors, bufs, n);
+    }
+    return blockdev_readv(u->dev, sectors, bufs, n);
+}
+
+/**
+ * @brief hint that the given sectors of a mounted filesystem will be read
+ *        soon (readahead): with a sector cache, the missing ones are read
+ *        into it together; otherwise the device is told to fetch them
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error (the sectors can still be read later)
+ */
+int u6fs_sector_prefetch(const struct unix_filesystem *u, const uint32_t *sectors, size_t n){
+    M_REQUIRE_NON_NULL(u);
+    if(u->cache != NULL){
+        return cache_prefetch(u->cache, sectors, n);
+    }
+    blockdev_prefetch(u->dev, sectors, n);
+    return ERR_NONE;
+}
+
+/**
+ * @brief write a scatter list of sectors of a mounted filesystem, through
+ *        its sector cache when it has one (see u6fs_sector_write())
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_writev(struct unix_filesystem *u, const uint32_t *sectors, const void *const *bufs, size_t n){
+    M_REQUIRE_NON_NULL(u);
+    if(u->flags & MOUNTV6_RDONLY) return ERR_IO;
+    int dirty = u6fs_sector_dirty(u);
+    if(dirty != ERR_NONE) return dirty;
+    if(u->cache != NULL){
+        return cache_writev(u->cache, sectors, bufs, n);
+    }
+    return blockdev_writev(u->dev, sectors, bufs, n);
+}
+
+/**
+ * @brief read count consecutive sectors of a mounted filesystem into one buffer
+ * @param u the mounted filesystem
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to read
+ * @param data a pointer to count * 512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_read_range(const struct unix_filesystem *u, uint32_t first, uint32_t count, void *data){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(data);
+    if(u->cache == NULL){
+        return blockdev_read(u->dev, first, count, data);
+    }
+    // go through the cache, SECTOR_IOV_MAX sectors at a time
+    uint32_t sectors[SECTOR_IOV_MAX];
+    void *bufs[SECTOR_IOV_MAX];
+    for(uint32_t done = 0; done < count; ){
+        const uint32_t len = count - done < SECTOR_IOV_MAX ? count - done : SECTOR_IOV_MAX;
+        for(uint32_t i = 0; i < len; ++i){
+            sectors[i] = first + done + i;
+            bufs[i] = (uint8_t *) data + (size_t) (done + i) * SECTOR_SIZE;
+        }
+        int err = cache_readv(u->cache, sectors, bufs, len);
+        if(err != ERR_NONE) return err;
+        done += len;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief write count consecutive sectors of a mounted filesystem from one buffer
+ * @param u the mounted filesystem
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to write
+ * @param data a pointer to count * 512 bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_write_range(struct unix_filesystem *u, uint32_t first, uint32_t count, const void *data){
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(data);
+    if(u->flags & MOUNTV6_RDONLY) return ERR_IO;
+    int dirty = u6fs_sector_dirty(u);
+    if(dirty != ERR_NONE) return dirty;
+    if(u->cache == NULL){
+        return blockdev_write(u->dev, first, count, data);
+    }
+    uint32_t sectors[SECTOR_IOV_MAX];
+    const void *bufs[SECTOR_IOV_MAX];
+    for(uint32_t done = 0; done < count; ){
+        const uint32_t len = count - done < SECTOR_IOV_MAX ? count - done : SECTOR_IOV_MAX;
+        for(uint32_t i = 0; i < len; ++i){
+            sectors[i] = first + done + i;
+            bufs[i] = (const uint8_t *) data + (size_t) (done + i) * SECTOR_SIZE;
+        }
+        int err = cache_writev(u->cache, sectors, bufs, len);
+        if(err != ERR_NONE) return err;
+        done += len;
+    }
+    return ERR_NONE;
+}
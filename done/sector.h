@@ -17,11 +17,14 @@
 extern "C" {
 #endif
 
+#define SECTOR_IOV_MAX 64 /* sectors per vectored system call */
+
 /* *************************************************** *
  * TODO WEEK 04										   *
  * *************************************************** */
 /**
  * @brief read one 512-byte sector from the virtual disk
+ *        (same as sector_pread() on the descriptor of f, once f is flushed)
  * @param f open file of the virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (OUT)
@@ -35,6 +38,7 @@ int sector_read(FILE *f, uint32_t sector, void *data);
  * *************************************************** */
 /**
  * @brief write one 512-byte sector from the virtual disk
+ *        (same as sector_pwrite() on the descriptor of f, once f is flushed)
  * @param f open file of the virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (IN)
@@ -42,6 +46,157 @@ int sector_read(FILE *f, uint32_t sector, void *data);
  */
 int sector_write(FILE *f, uint32_t sector, const void *data);
 
+/**
+ * @brief read one 512-byte sector from the virtual disk, at its position
+ *        (thread-safe: no file cursor is involved)
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short read)
+ */
+int sector_pread(int fd, uint32_t sector, void *data);
+
+/**
+ * @brief write one 512-byte sector to the virtual disk, at its position
+ *        (thread-safe: no file cursor is involved)
+ * @param fd file descriptor of the virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short write)
+ */
+int sector_pwrite(int fd, uint32_t sector, const void *data);
+
+/**
+ * @brief read count consecutive sectors into one buffer, with a single
+ *        positional read
+ * @param fd file descriptor of the virtual disk
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to read
+ * @param data a pointer to count * 512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short read)
+ */
+int sector_pread_range(int fd, uint32_t first, uint32_t count, void *data);
+
+/**
+ * @brief write count consecutive sectors from one buffer, with a single
+ *        positional write
+ * @param fd file descriptor of the virtual disk
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to write
+ * @param data a pointer to count * 512 bytes of memory (IN)
+ * @return 0 on success; <0 on error (ERR_IO for any failed or short write)
+ */
+int sector_pwrite_range(int fd, uint32_t first, uint32_t count, const void *data);
+
+/**
+ * @brief read a scatter list of sectors; each run of consecutive sectors is
+ *        read with a single preadv() (of at most SECTOR_IOV_MAX sectors)
+ * @param fd file descriptor of the virtual disk
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_preadv(int fd, const uint32_t *sectors, void *const *bufs, size_t n);
+
+/**
+ * @brief write a scatter list of sectors; each run of consecutive sectors is
+ *        written with a single pwritev() (of at most SECTOR_IOV_MAX sectors)
+ * @param fd file descriptor of the virtual disk
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_pwritev(int fd, const uint32_t *sectors, const void *const *bufs, size_t n);
+
+/**
+ * @brief read one 512-byte sector of a mounted filesystem, through its
+ *        sector cache when it has one
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_read(const struct unix_filesystem *u, uint32_t sector, void *data);
+
+/**
+ * @brief give access to one 512-byte sector of a mounted filesystem without
+ *        copying it when the device is in memory; otherwise the sector is
+ *        read (see u6fs_sector_read()) into buf
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param buf a pointer to 512-bytes of memory, only used if the device is not in memory
+ * @param data set to the content of the sector, i.e. into the device or buf (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_get(const struct unix_filesystem *u, uint32_t sector, void *buf, const void **data);
+
+/**
+ * @brief write one 512-byte sector of a mounted filesystem, through its
+ *        sector cache when it has one (the disk is then updated at the latest
+ *        by umountv6())
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_write(struct unix_filesystem *u, uint32_t sector, const void *data);
+
+/**
+ * @brief read count consecutive sectors of a mounted filesystem into one buffer
+ * @param u the mounted filesystem
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to read
+ * @param data a pointer to count * 512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_read_range(const struct unix_filesystem *u, uint32_t first, uint32_t count, void *data);
+
+/**
+ * @brief write count consecutive sectors of a mounted filesystem from one buffer
+ * @param u the mounted filesystem
+ * @param first the location (in sector units, not bytes) of the first sector
+ * @param count the number of sectors to write
+ * @param data a pointer to count * 512 bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_write_range(struct unix_filesystem *u, uint32_t first, uint32_t count, const void *data);
+
+/**
+ * @brief read a scatter list of sectors of a mounted filesystem: sectors
+ *        found in the cache are copied, the others are fetched from the
+ *        device together
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (OUT)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_readv(const struct unix_filesystem *u, const uint32_t *sectors, void *const *bufs, size_t n);
+
+/**
+ * @brief hint that the given sectors of a mounted filesystem will be read
+ *        soon (readahead): with a sector cache, the missing ones are read
+ *        into it together; otherwise the device is told to fetch them
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error (the sectors can still be read later)
+ */
+int u6fs_sector_prefetch(const struct unix_filesystem *u, const uint32_t *sectors, size_t n);
+
+/**
+ * @brief write a scatter list of sectors of a mounted filesystem, through
+ *        its sector cache when it has one (see u6fs_sector_write())
+ * @param u the mounted filesystem
+ * @param sectors the locations (in sector units) of the n sectors
+ * @param bufs n pointers to 512-bytes of memory (IN)
+ * @param n the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int u6fs_sector_writev(struct unix_filesystem *u, const uint32_t *sectors, const void *const *bufs, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,13 +9,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>   // UINT16_MAX
+#include <fcntl.h>    // open(), posix_fadvise()
+#include <sys/stat.h> // fstat()
+#include <unistd.h>   // read(), close()
 
 #include "error.h"
 #include "mount.h"
 #include "u6fs_utils.h"
 #include "inode.h"
 #include "direntv6.h"
+#include "filev6.h"
+#include "sector.h"
 #include "u6fs_fuse.h"
+#include "u6fs_bulk.h"
 
 /* *************************************************** *
  * TODO WEEK 04-07: Add more messages                  *
@@ -28,11 +36,14 @@ static void usage(const char *execname, int err)
         pps_printf("%s <disk> inode\n", execname);
         pps_printf("%s <disk> cat1 <inr>\n", execname);
         pps_printf("%s <disk> shafiles\n", execname);
-        pps_printf("%s <disk> tree", execname);
-        pps_printf("%s <disk> fuse <mountpoint>", execname);
-        pps_printf("%s <disk> bm", execname);
-        pps_printf("%s <disk> mkdir </path/to/newdir>", execname);
-        pps_printf("%s <disk> add <dest> <src>", execname);
+        pps_printf("%s <disk> tree\n", execname);
+        pps_printf("%s <disk> fuse <mountpoint>\n", execname);
+        pps_printf("%s <disk> bm\n", execname);
+        pps_printf("%s <disk> mkdir </path/to/newdir>\n", execname);
+        pps_printf("%s <disk> add <dest> <src>\n", execname);
+        pps_printf("%s <disk> import <hostdir> <dest>\n", execname);
+        pps_printf("%s <disk> export <src> <hostdir>\n", execname);
+        pps_printf("%s <disk> mkfs <num_blocks> <num_inodes>\n", execname);
     } 
      else if (err > ERR_FIRST && err < ERR_LAST) {
         pps_printf("%s: Error: %s\n", execname, ERR_MESSAGES[err - ERR_FIRST]);
@@ -43,6 +54,31 @@ static void usage(const char *execname, int err)
 
 #define CMD(a, b) (strcmp(argv[2], a) == 0 && argc == (b))
 
+/**
+ * @brief tells whether the given command modifies the filesystem
+ */
+static int u6fs_cmd_writes(const char *cmd)
+{
+    return strcmp(cmd, "mkdir") == 0 || strcmp(cmd, "add") == 0 || strcmp(cmd, "import") == 0;
+}
+
+/**
+ * @brief parse a decimal number of the command line that must fit a uint16_t
+ * @param str the argument
+ * @param value the number (OUT)
+ * @return 0 on success; ERR_BAD_PARAMETER if str is not such a number
+ */
+static int u6fs_parse_u16(const char *str, uint16_t *value)
+{
+    if (str[0] < '0' || str[0] > '9') return ERR_BAD_PARAMETER;
+    errno = 0;
+    char *end = NULL;
+    const unsigned long n = strtoul(str, &end, 10);
+    if (errno != 0 || *end != '\0' || n > UINT16_MAX) return ERR_BAD_PARAMETER;
+    *value = (uint16_t) n;
+    return ERR_NONE;
+}
+
 /* *************************************************** *
  * TODO WEEK 04-11: Add more commands                  *
  * *************************************************** */
@@ -55,9 +91,38 @@ static void usage(const char *execname, int err)
 int u6fs_do_one_cmd(int argc, char *argv[])
 {
     if (argc < 3) return ERR_INVALID_COMMAND;
+    if (CMD("mkfs", 5)) {
+        // creates the disk: nothing to mount
+        uint16_t num_blocks = 0, num_inodes = 0;
+        if (u6fs_parse_u16(argv[3], &num_blocks) != ERR_NONE
+            || u6fs_parse_u16(argv[4], &num_inodes) != ERR_NONE) {
+            return ERR_BAD_PARAMETER;
+        }
+        return mountv6_mkfs(argv[1], num_blocks, num_inodes);
+    }
+
+    // every command ends with umountv6(), so sector writes can be deferred until then
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags |= MOUNTV6_WRITEBACK;
+    if (!u6fs_cmd_writes(argv[2])) {
+        // read-only commands share the mapped image instead of copying sectors,
+        // and never allocate: only bm needs the bitmaps, it builds them itself
+        opts.flags |= MOUNTV6_RDONLY | MOUNTV6_MMAP | MOUNTV6_LAZY;
+    } else {
+        // without the mapping, keep the inode table reads in flight at mount
+        opts.flags |= MOUNTV6_ASYNC;
+    }
+    if (getenv("U6FS_RAMDISK") != NULL) {
+        // the whole image in private memory, saved back at umountv6() by writing commands
+        opts.flags = (opts.flags & ~MOUNTV6_MMAP) | MOUNTV6_RAM;
+    }
+    const char *cache_size = getenv("U6FS_CACHE_SIZE"); // in bytes; 0 disables the cache
+    if (cache_size != NULL) {
+        opts.cache_size = strtoul(cache_size, NULL, 10);
+    }
 
     struct unix_filesystem u = {0};
-    int error = mountv6(argv[1], &u), err2 = 0;
+    int error = mountv6_opt(argv[1], &u, &opts), err2 = 0;
 
     if (error != ERR_NONE) {
         debug_printf("Could not mount fs%s", "\n");
@@ -96,6 +161,12 @@ int u6fs_do_one_cmd(int argc, char *argv[])
     else if(CMD("add", 5)){
         error = add_file(&u, argv[3], argv[4]);
     }
+    else if(CMD("import", 5)){
+        error = bulk_import(&u, argv[3], argv[4]);
+    }
+    else if(CMD("export", 5)){
+        error = bulk_export(&u, argv[3], argv[4]);
+    }
     else {
         error = ERR_INVALID_COMMAND;
     }
@@ -104,27 +175,61 @@ int u6fs_do_one_cmd(int argc, char *argv[])
     return (error == ERR_NONE ? err2 : error);
 }
 
+#define ADD_CHUNK_SIZE (2 * SECTOR_IOV_MAX * SECTOR_SIZE) /* bytes read from the host file at once */
+
+/**
+ * @brief copy a host file into a new file of the filesystem, one fixed-size
+ *        chunk at a time: whole chunks are written as vectored writes, and
+ *        the kernel reads the next chunk ahead meanwhile
+ * @param u the mounted filesystem
+ * @param dst the absolute path of the new file
+ * @param src the path of the host file
+ * @return 0 on success; <0 on error
+ */
 int add_file(struct unix_filesystem* u, const char* dst, const char* src){
-    #define MAX 4000
+    const int fd = open(src, O_RDONLY);
+    if(fd < 0) return ERR_NO_SUCH_FILE;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        close(fd);
+        return ERR_IO;
+    }
+    // fail before the directory entry is created
+    if(st.st_size > (off_t) (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE){
+        close(fd);
+        return ERR_FILE_TOO_LARGE;
+    }
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    FILE* file = fopen(src, "rb");
-    if(!file) return ERR_NO_SUCH_FILE;
-    fseek(file, 0, SEEK_END);
-    long size_bytes  = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    if(size_bytes > MAX) return ERR_FILE_TOO_LARGE;
+    char *chunk = malloc(ADD_CHUNK_SIZE);
+    int inr = chunk != NULL ? direntv6_create(u, dst, IREAD | IEXEC | IWRITE) : ERR_NOMEM;
+    if(inr < 0){
+        free(chunk);
+        close(fd);
+        return inr;
+    }
 
-    char buffer[size_bytes];
-    size_t bytesRead = fread(buffer, sizeof(char), size_bytes, file);
-    if(bytesRead != size_bytes) {
-        fclose(file);
-        return ERR_NOMEM;
+    struct filev6 file;
+    int err = filev6_open(u, (uint16_t) inr, &file);
+    // the whole file in one run of sectors, shared by the successive writes
+    if(err == ERR_NONE) err = filev6_prealloc(&file, (size_t) st.st_size);
+    while(err == ERR_NONE){
+        const ssize_t n = read(fd, chunk, ADD_CHUNK_SIZE);
+        if(n < 0){
+            err = ERR_IO;
+        }else if(n == 0){
+            break;
+        }else{
+            err = filev6_writebytes(&file, chunk, (size_t) n);
+        }
     }
-    fclose(file);
+    const int err_close = filev6_close(&file);
 
-    int add = direntv6_addfile(u, dst, IREAD | IEXEC | IWRITE, buffer, size_bytes);
-    return add;
+    free(chunk);
+    close(fd);
+    return err != ERR_NONE ? err : err_close;
 }
+
 #ifndef FUZZ
 /**
  * @brief main function, runs the requested command and prints the resulting error if any.
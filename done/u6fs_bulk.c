@@ -0,0 +1,625 @@
+/**
+ * @file u6fs_bulk.c
+ * @brief bulk transfers of whole trees between the host and a filesystem
+ *
+ * @date spring 2023
+ */
+
+#include <stdio.h>    // snprintf()
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>   // opendir()
+#include <errno.h>
+#include <fcntl.h>    // open()
+#include <pthread.h>
+#include <sys/stat.h> // lstat(), mkdir()
+#include <unistd.h>   // read(), write(), sysconf()
+#include "u6fs_bulk.h"
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "error.h"
+
+#define BULK_FILE_MODE (IREAD | IEXEC | IWRITE)
+#define BULK_DIR_MODE (IFDIR | IREAD | IEXEC | IWRITE)
+#define BULK_MAX_FILE_SIZE ((size_t) (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE)
+
+/* ====================================================================== *
+ * host tree                                                              *
+ * ====================================================================== */
+
+struct bulk_node {
+    char *path;                 // on the host
+    char name[DIRENT_MAXLEN + 1];
+    int is_dir;
+    size_t size;                // files: in bytes
+    size_t first_child;         // directories: the entries are the nodes
+    size_t nchildren;           //     [first_child, first_child + nchildren)
+    uint16_t inr;               // in the filesystem, once allocated
+    uint32_t sector;            // export: the first sector of the file, to read the files in disk order
+};
+
+struct bulk_tree {
+    struct bulk_node *nodes;    // breadth first: the entries of a directory are consecutive
+    size_t n;
+    size_t capacity;
+};
+
+static void bulk_tree_free(struct bulk_tree *t)
+{
+    for (size_t i = 0; i < t->n; ++i) free(t->nodes[i].path);
+    free(t->nodes);
+    t->nodes = NULL;
+    t->n = t->capacity = 0;
+}
+
+static int bulk_node_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct bulk_node *) a)->name, ((const struct bulk_node *) b)->name);
+}
+
+/**
+ * @brief append the regular files and directories of the host directory
+ *        t->nodes[d] to the tree, sorted by name
+ * @return 0 on success; <0 on error
+ */
+static int bulk_walk_dir(struct bulk_tree *t, size_t d)
+{
+    DIR *dir = opendir(t->nodes[d].path);
+    if (dir == NULL) return d == 0 ? ERR_NO_SUCH_FILE : ERR_IO;
+
+    const size_t first = t->n;
+    int err = ERR_NONE;
+    const struct dirent *e;
+    while (err == ERR_NONE && (e = readdir(dir)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+
+        const size_t len = strlen(t->nodes[d].path) + 1 + strlen(e->d_name) + 1;
+        char *path = malloc(len);
+        if (path == NULL) {
+            err = ERR_NOMEM;
+            break;
+        }
+        snprintf(path, len, "%s/%s", t->nodes[d].path, e->d_name);
+        struct stat st;
+        if (lstat(path, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+            free(path);
+            continue;
+        }
+        if (strlen(e->d_name) > DIRENT_MAXLEN) {
+            err = ERR_FILENAME_TOO_LONG;
+        } else if (S_ISREG(st.st_mode) && (size_t) st.st_size > BULK_MAX_FILE_SIZE) {
+            err = ERR_FILE_TOO_LARGE;
+        } else if (t->n == t->capacity) {
+            const size_t capacity = t->capacity == 0 ? 64 : 2 * t->capacity;
+            struct bulk_node *nodes = realloc(t->nodes, capacity * sizeof(struct bulk_node));
+            if (nodes == NULL) {
+                err = ERR_NOMEM;
+            } else {
+                t->nodes = nodes;
+                t->capacity = capacity;
+            }
+        }
+        if (err != ERR_NONE) {
+            free(path);
+            break;
+        }
+
+        struct bulk_node *node = &t->nodes[t->n++];
+        memset(node, 0, sizeof(struct bulk_node));
+        node->path = path;
+        strcpy(node->name, e->d_name);
+        node->is_dir = S_ISDIR(st.st_mode);
+        node->size = node->is_dir ? 0 : (size_t) st.st_size;
+    }
+    closedir(dir);
+
+    t->nodes[d].first_child = first;
+    t->nodes[d].nchildren = t->n - first;
+    qsort(t->nodes + first, t->n - first, sizeof(struct bulk_node), bulk_node_cmp);
+    return err;
+}
+
+/**
+ * @brief list the whole host tree, breadth first
+ * @return 0 on success; <0 on error
+ */
+static int bulk_walk(struct bulk_tree *t, const char *hostdir)
+{
+    t->nodes = calloc(1, sizeof(struct bulk_node));
+    if (t->nodes == NULL) return ERR_NOMEM;
+    t->capacity = t->n = 1;
+    t->nodes[0].path = strdup(hostdir);
+    if (t->nodes[0].path == NULL) return ERR_NOMEM;
+    t->nodes[0].is_dir = 1;
+
+    int err = ERR_NONE;
+    for (size_t d = 0; d < t->n && err == ERR_NONE; ++d) {
+        if (t->nodes[d].is_dir) err = bulk_walk_dir(t, d);
+    }
+    return err;
+}
+
+/* ====================================================================== *
+ * parallel reads of host files                                           *
+ * ====================================================================== */
+
+struct bulk_read {
+    const struct bulk_node *node;
+    char *data;                 // node->size bytes
+    size_t length;              // bytes read (the file may have shrunk since the walk)
+    int err;
+};
+
+struct bulk_batch {
+    struct bulk_read *reads;
+    size_t n;
+    size_t next;                // next file to read, shared by the workers
+};
+
+static int bulk_read_file(struct bulk_read *r)
+{
+    const int fd = open(r->node->path, O_RDONLY);
+    if (fd < 0) return ERR_IO;
+    while (r->length < r->node->size) {
+        const ssize_t n = read(fd, r->data + r->length, r->node->size - r->length);
+        if (n < 0) {
+            close(fd);
+            return ERR_IO;
+        }
+        if (n == 0) break;
+        r->length += (size_t) n;
+    }
+    close(fd);
+    return ERR_NONE;
+}
+
+static void *bulk_read_worker(void *arg)
+{
+    struct bulk_batch *b = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n) {
+        b->reads[i].err = bulk_read_file(&b->reads[i]);
+    }
+    return NULL;
+}
+
+/**
+ * @brief number of threads for a pool: at most one per CPU, max and one per job
+ */
+static size_t bulk_nthreads(size_t max, size_t jobs)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    size_t n = (size_t) ncpu < max ? (size_t) ncpu : max;
+    return n < jobs ? n : jobs;
+}
+
+/**
+ * @brief read the files of a batch, with up to BULK_THREADS threads (the
+ *        calling one included)
+ */
+static void bulk_read_batch(struct bulk_batch *b)
+{
+    const size_t n = bulk_nthreads(BULK_THREADS, b->n);
+
+    pthread_t threads[BULK_THREADS];
+    size_t started = 0;
+    // without a thread, the calling one reads more files
+    while (started + 1 < n && pthread_create(&threads[started], NULL, bulk_read_worker, b) == 0) ++started;
+    bulk_read_worker(b);
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+}
+
+/* ====================================================================== *
+ * import                                                                 *
+ * ====================================================================== */
+
+/**
+ * @brief write the content of a batch of files, in order
+ * @return 0 on success; <0 on error
+ */
+static int bulk_write_batch(struct unix_filesystem *u, const struct bulk_batch *b)
+{
+    for (size_t i = 0; i < b->n; ++i) {
+        const struct bulk_read *r = &b->reads[i];
+        if (r->err != ERR_NONE) return r->err;
+        if (r->length == 0) continue;
+
+        struct filev6 f;
+        int err = filev6_open(u, r->node->inr, &f);
+        if (err == ERR_NONE) err = filev6_writebytes(&f, r->data, r->length);
+        const int err_close = filev6_close(&f);
+        if (err != ERR_NONE) return err;
+        if (err_close != ERR_NONE) return err_close;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief copy the content of the files among the entries [first, end) of a
+ *        directory, one batch of at most BULK_BATCH_SIZE bytes at a time
+ * @return 0 on success; <0 on error
+ */
+static int bulk_import_files(struct unix_filesystem *u, const struct bulk_tree *t, size_t first, size_t end)
+{
+    struct bulk_read *reads = calloc(end - first, sizeof(struct bulk_read));
+    if (reads == NULL) return ERR_NOMEM;
+
+    int err = ERR_NONE;
+    size_t i = first;
+    while (i < end && err == ERR_NONE) {
+        struct bulk_batch b = { reads, 0, 0 };
+        size_t bytes = 0;
+        for (; i < end && err == ERR_NONE; ++i) {
+            const struct bulk_node *node = &t->nodes[i];
+            if (node->is_dir) continue;
+            // a file larger than the budget makes a batch on its own
+            if (b.n > 0 && bytes + node->size > BULK_BATCH_SIZE) break;
+            struct bulk_read *r = &reads[b.n++];
+            memset(r, 0, sizeof(struct bulk_read));
+            r->node = node;
+            r->data = malloc(node->size > 0 ? node->size : 1);
+            if (r->data == NULL) err = ERR_NOMEM;
+            bytes += node->size;
+        }
+
+        if (err == ERR_NONE) {
+            bulk_read_batch(&b);
+            err = bulk_write_batch(u, &b);
+        }
+        for (size_t k = 0; k < b.n; ++k) free(reads[k].data);
+    }
+    free(reads);
+    return err;
+}
+
+/**
+ * @brief create the entries of the directory t->nodes[d] (whose inode is
+ *        known): their inodes first, then all the directory entries with a
+ *        single append, then the content of the files
+ * @return 0 on success; <0 on error
+ */
+static int bulk_import_dir(struct unix_filesystem *u, struct bulk_tree *t, size_t d)
+{
+    const size_t first = t->nodes[d].first_child;
+    const size_t n = t->nodes[d].nchildren;
+    if (n == 0) return ERR_NONE;
+
+    struct direntv6 *entries = calloc(n, sizeof(struct direntv6));
+    if (entries == NULL) return ERR_NOMEM;
+
+    int err = ERR_NONE;
+    for (size_t i = 0; i < n && err == ERR_NONE; ++i) {
+        struct bulk_node *node = &t->nodes[first + i];
+        const uint16_t mode = node->is_dir ? BULK_DIR_MODE : BULK_FILE_MODE;
+        const int inr = inode_alloc_near(u, t->nodes[d].inr, mode);
+        if (inr < 0) {
+            err = inr;
+            break;
+        }
+        struct inode in;
+        memset(&in, 0, sizeof(struct inode));
+        in.i_mode = IALLOC | mode;
+        err = inode_write(u, (uint16_t) inr, &in);
+
+        node->inr = (uint16_t) inr;
+        entries[i].d_inumber = (uint16_t) inr;
+        strncpy(entries[i].d_name, node->name, DIRENT_MAXLEN);
+    }
+
+    if (err == ERR_NONE) {
+        struct filev6 f;
+        err = filev6_open(u, t->nodes[d].inr, &f);
+        if (err == ERR_NONE) err = filev6_writebytes(&f, entries, n * sizeof(struct direntv6));
+        const int err_close = filev6_close(&f);
+        if (err == ERR_NONE) err = err_close;
+    }
+    free(entries);
+
+    if (err == ERR_NONE) err = bulk_import_files(u, t, first, first + n);
+    return err;
+}
+
+/**
+ * @brief find or create the destination directory, and check that none of
+ *        the entries to import exist in it
+ * @return the inode number of the directory on success; <0 on error
+ */
+static int bulk_import_dest(struct unix_filesystem *u, const struct bulk_tree *t, const char *dest)
+{
+    int inr = direntv6_dirlookup(u, ROOT_INUMBER, dest);
+    if (inr == ERR_NO_SUCH_FILE) return direntv6_create(u, dest, BULK_DIR_MODE);
+    if (inr < 0) return inr;
+
+    struct inode in;
+    int err = inode_read(u, (uint16_t) inr, &in);
+    if (err != ERR_NONE) return err;
+    if (!(in.i_mode & IFDIR)) return ERR_INVALID_DIRECTORY_INODE;
+
+    for (size_t i = t->nodes[0].first_child; i < t->nodes[0].first_child + t->nodes[0].nchildren; ++i) {
+        if (direntv6_dirlookup(u, (uint16_t) inr, t->nodes[i].name) >= 0) return ERR_FILENAME_ALREADY_EXISTS;
+    }
+    return inr;
+}
+
+int bulk_import(struct unix_filesystem *u, const char *hostdir, const char *dest)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(hostdir);
+    M_REQUIRE_NON_NULL(dest);
+
+    // everything is checked before the first write
+    struct bulk_tree t = { NULL, 0, 0 };
+    int err = bulk_walk(&t, hostdir);
+    if (err == ERR_NONE) {
+        const int inr = bulk_import_dest(u, &t, dest);
+        if (inr < 0) {
+            err = inr;
+        } else {
+            t.nodes[0].inr = (uint16_t) inr;
+        }
+    }
+
+    // breadth first: a directory is created before its entries
+    for (size_t d = 0; d < t.n && err == ERR_NONE; ++d) {
+        if (t.nodes[d].is_dir) err = bulk_import_dir(u, &t, d);
+    }
+    bulk_tree_free(&t);
+    return err;
+}
+
+/* ====================================================================== *
+ * export                                                                 *
+ * ====================================================================== */
+
+/**
+ * @brief append a node to the tree, with path parent/name
+ * @return the new node on success; NULL if out of memory
+ */
+static struct bulk_node *bulk_tree_add(struct bulk_tree *t, const char *parent, const char *name)
+{
+    if (t->n == t->capacity) {
+        const size_t capacity = t->capacity == 0 ? 64 : 2 * t->capacity;
+        struct bulk_node *nodes = realloc(t->nodes, capacity * sizeof(struct bulk_node));
+        if (nodes == NULL) return NULL;
+        t->nodes = nodes;
+        t->capacity = capacity;
+    }
+    const size_t len = strlen(parent) + 1 + strlen(name) + 1;
+    char *path = malloc(len);
+    if (path == NULL) return NULL;
+    snprintf(path, len, "%s%s%s", parent, *name != '\0' ? "/" : "", name);
+
+    struct bulk_node *node = &t->nodes[t->n++];
+    memset(node, 0, sizeof(struct bulk_node));
+    node->path = path;
+    strncpy(node->name, name, DIRENT_MAXLEN);
+    return node;
+}
+
+/**
+ * @brief list the entries of the directory t->nodes[d] of the filesystem,
+ *        creating the host directories on the way
+ * @param seen one byte per inode: the directories already listed (against cycles)
+ * @return 0 on success; <0 on error
+ */
+static int bulk_export_dir(const struct unix_filesystem *u, struct bulk_tree *t, size_t d, uint8_t *seen)
+{
+    if (mkdir(t->nodes[d].path, 0755) != 0 && errno != EEXIST) return ERR_IO;
+
+    struct directory_reader dr;
+    memset(&dr, 0, sizeof(struct directory_reader));
+    int err = direntv6_opendir(u, t->nodes[d].inr, &dr);
+    if (err != ERR_NONE) return err;
+
+    char name[DIRENT_MAXLEN + 1] = {0};
+    uint16_t inr = 0;
+    int res;
+    while (err == ERR_NONE && (res = direntv6_readdir(&dr, name, &inr)) != 0) {
+        if (res < 0) return res;
+        // nothing outside of hostdir, whatever the image holds
+        if (inr == 0 || name[0] == '\0' || strchr(name, '/') != NULL
+            || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        struct inode in;
+        err = inode_read(u, inr, &in);
+        if (err != ERR_NONE) break;
+        if ((in.i_mode & IFDIR) && seen[inr]) continue;
+        seen[inr] = 1;
+
+        struct bulk_node *node = bulk_tree_add(t, t->nodes[d].path, name);
+        if (node == NULL) return ERR_NOMEM;
+        node->inr = inr;
+        node->is_dir = (in.i_mode & IFDIR) != 0;
+        if (!node->is_dir) {
+            node->size = (size_t) inode_getsize(&in);
+            // unreadable files (e.g. too large) fail when they are read
+            const int sector = node->size > 0 ? inode_findsector(u, &in, 0) : 0;
+            node->sector = sector > 0 ? (uint32_t) sector : 0;
+        }
+    }
+    return err;
+}
+
+struct bulk_write {
+    const char *path;
+    char *data;                 // freed once written
+    size_t length;
+};
+
+/* the host writes: jobs [0, ready) are read, [0, next) are taken by a worker */
+struct bulk_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // a job is ready, a job is written or the pool is done
+    struct bulk_write *jobs;
+    size_t ready;
+    size_t next;
+    size_t in_flight;           // bytes read and not written yet
+    int done;                   // no more jobs will come
+    int err;                    // the first write error
+};
+
+static int bulk_write_file(const struct bulk_write *w)
+{
+    const int fd = open(w->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return ERR_IO;
+    size_t done = 0;
+    while (done < w->length) {
+        const ssize_t n = write(fd, w->data + done, w->length - done);
+        if (n <= 0) {
+            close(fd);
+            return ERR_IO;
+        }
+        done += (size_t) n;
+    }
+    return close(fd) == 0 ? ERR_NONE : ERR_IO;
+}
+
+static void *bulk_write_worker(void *arg)
+{
+    struct bulk_pool *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->next == p->ready && !p->done) pthread_cond_wait(&p->cond, &p->lock);
+        if (p->next == p->ready) break;
+        struct bulk_write *w = &p->jobs[p->next++];
+        pthread_mutex_unlock(&p->lock);
+
+        const int err = bulk_write_file(w);
+        free(w->data);
+        w->data = NULL;
+
+        pthread_mutex_lock(&p->lock);
+        if (err != ERR_NONE && p->err == ERR_NONE) p->err = err;
+        p->in_flight -= w->length;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static int bulk_sector_cmp(const void *a, const void *b)
+{
+    const struct bulk_node *x = *(const struct bulk_node *const *) a;
+    const struct bulk_node *y = *(const struct bulk_node *const *) b;
+    return (x->sector > y->sector) - (x->sector < y->sector);
+}
+
+/**
+ * @brief read the files of the tree in disk order, and hand them over to
+ *        the writers
+ * @return 0 on success; <0 on error
+ */
+static int bulk_export_files(const struct unix_filesystem *u, struct bulk_pool *p,
+                             const struct bulk_node **files, size_t nfiles)
+{
+    int err = ERR_NONE;
+    for (size_t i = 0; i < nfiles && err == ERR_NONE; ++i) {
+        const struct bulk_node *node = files[i];
+        char *data = malloc(node->size > 0 ? node->size : 1);
+        if (data == NULL) {
+            err = ERR_NOMEM;
+            break;
+        }
+        struct filev6 f;
+        err = filev6_open(u, node->inr, &f);
+        int length = 0;
+        if (err == ERR_NONE) length = filev6_pread(&f, data, node->size, 0);
+        if (length < 0) err = length;
+        if (err != ERR_NONE) {
+            free(data);
+            break;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        // bounded memory: wait for the writers (a single file may exceed the budget)
+        while (p->in_flight > 0 && p->in_flight + (size_t) length > BULK_BATCH_SIZE && p->err == ERR_NONE) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        err = p->err;
+        if (err == ERR_NONE) {
+            p->jobs[p->ready].path = node->path;
+            p->jobs[p->ready].data = data;
+            p->jobs[p->ready].length = (size_t) length;
+            p->in_flight += (size_t) length;
+            ++p->ready;
+            pthread_cond_broadcast(&p->cond);
+        } else {
+            free(data);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return err;
+}
+
+int bulk_export(const struct unix_filesystem *u, const char *src, const char *hostdir)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(src);
+    M_REQUIRE_NON_NULL(hostdir);
+
+    const int root = direntv6_dirlookup(u, ROOT_INUMBER, src);
+    if (root < 0) return root;
+    uint8_t *seen = calloc(UINT16_MAX + 1, 1);
+    struct bulk_tree t = { NULL, 0, 0 };
+    struct bulk_node *node = seen != NULL ? bulk_tree_add(&t, hostdir, "") : NULL;
+    if (node == NULL) {
+        free(seen);
+        bulk_tree_free(&t);
+        return ERR_NOMEM;
+    }
+    node->inr = (uint16_t) root;
+    node->is_dir = 1;
+    seen[root] = 1;
+
+    // breadth first: a host directory is created before its entries
+    int err = ERR_NONE;
+    for (size_t d = 0; d < t.n && err == ERR_NONE; ++d) {
+        if (t.nodes[d].is_dir) err = bulk_export_dir(u, &t, d, seen);
+    }
+    free(seen);
+
+    size_t nfiles = 0;
+    const struct bulk_node **files = err == ERR_NONE ? calloc(t.n, sizeof(struct bulk_node *)) : NULL;
+    struct bulk_write *jobs = files != NULL ? calloc(t.n, sizeof(struct bulk_write)) : NULL;
+    if (err == ERR_NONE && jobs == NULL) err = ERR_NOMEM;
+    if (err == ERR_NONE) {
+        for (size_t i = 0; i < t.n; ++i) {
+            if (!t.nodes[i].is_dir) files[nfiles++] = &t.nodes[i];
+        }
+        // one pass over the disk instead of one seek per file
+        qsort(files, nfiles, sizeof(struct bulk_node *), bulk_sector_cmp);
+
+        struct bulk_pool p;
+        memset(&p, 0, sizeof(struct bulk_pool));
+        pthread_mutex_init(&p.lock, NULL);
+        pthread_cond_init(&p.cond, NULL);
+        p.jobs = jobs;
+
+        const size_t n = bulk_nthreads(BULK_THREADS, nfiles);
+        pthread_t threads[BULK_THREADS];
+        size_t started = 0;
+        while (started < n
+               && pthread_create(&threads[started], NULL, bulk_write_worker, &p) == 0) ++started;
+
+        if (started == 0 && nfiles > 0) {
+            err = ERR_NOMEM;
+        } else {
+            err = bulk_export_files(u, &p, files, nfiles);
+        }
+        pthread_mutex_lock(&p.lock);
+        p.done = 1;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+        for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+        if (err == ERR_NONE) err = p.err;
+
+        pthread_cond_destroy(&p.cond);
+        pthread_mutex_destroy(&p.lock);
+    }
+    free(jobs);
+    free(files);
+    bulk_tree_free(&t);
+    return err;
+}
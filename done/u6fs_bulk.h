@@ -0,0 +1,59 @@
+#pragma once
+
+/**
+ * @file u6fs_bulk.h
+ * @brief bulk transfers of whole trees between the host and a filesystem
+ *
+ * An import walks the host directory first, so that nothing is written if
+ * an entry cannot be imported (name too long, file too large). It then
+ * creates the tree one directory at a time, breadth first. For each
+ * directory, it allocates the inodes of the entries one after the other,
+ * writes all the directory entries with a single append, and copies the
+ * content of the files. The files are read from the host by worker threads,
+ * in batches of at most BULK_BATCH_SIZE bytes, and written in directory
+ * order. The inodes and the data of a tree thus end up laid out
+ * sequentially, and the whole tree costs a single mount.
+ *
+ * An export walks the tree of the filesystem and creates the host
+ * directories, then reads the files in the order of their first sector on
+ * disk. A pool of worker threads writes them to the host meanwhile; at
+ * most BULK_BATCH_SIZE bytes are read and not yet written at any time.
+ *
+ * @date spring 2023
+ */
+
+#include "mount.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BULK_THREADS 8                /* worker threads of a pool, at most */
+#define BULK_BATCH_SIZE (4u << 20)    /* bytes of host files read in parallel at once */
+
+/**
+ * @brief copy a host directory tree (regular files and directories; other
+ *        entries, such as symbolic links, are skipped) into a directory
+ *        of the filesystem
+ * @param u the mounted filesystem
+ * @param hostdir the host directory to import
+ * @param dest the absolute path of the directory receiving the entries of
+ *        hostdir (created if it does not exist; none of these entries
+ *        may exist in it yet)
+ * @return 0 on success; <0 on error
+ */
+int bulk_import(struct unix_filesystem *u, const char *hostdir, const char *dest);
+
+/**
+ * @brief copy a directory tree of the filesystem into a host directory
+ * @param u the mounted filesystem
+ * @param src the absolute path of the directory to export
+ * @param hostdir the host directory receiving the entries of src (created
+ *        if it does not exist; existing files are overwritten)
+ * @return 0 on success; <0 on error
+ */
+int bulk_export(const struct unix_filesystem *u, const char *src, const char *hostdir);
+
+#ifdef __cplusplus
+}
+#endif
@@ -28,6 +28,11 @@
 
 static struct unix_filesystem* theFS = NULL; // usefull for tests
 
+// the file of the last fs_read(), kept open so that its readahead state
+// survives between the successive reads of the kernel (FUSE runs single threaded)
+static struct filev6 lastFile;
+static int lastFileValid = 0;
+
 /**
  * @file u6fs_fuse.h
  * @brief Fills a stat struct with the attributes of a file
@@ -154,37 +159,19 @@ int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
         return inr;
     }
 
-    struct filev6 f;
-    memset(&f, 0, sizeof(struct filev6));
-    int res = filev6_open(theFS, inr, &f);
-    if(res < 0) return res;
-
-    int err = filev6_lseek(&f, offset);
-    if(err < 0) return err;
-
- 
-    size_t length = 0;
-    int bytes_read = SECTOR_SIZE;
-    char data[SECTOR_SIZE] = {0};
-    while(bytes_read == SECTOR_SIZE && length < size){
-        bytes_read = filev6_readblock(&f, data);
-        if(bytes_read == SECTOR_SIZE){
-            if(length + SECTOR_SIZE > size){
-                memcpy(buf + length, data, size - length);
-                length = size;
-            }else{
-                memcpy(buf + length, data, SECTOR_SIZE);
-                length += SECTOR_SIZE;
-            }
-        }else if(bytes_read < 0){
-            return bytes_read;
-        }else{
-            int remaining_length = ((size - length) > bytes_read) ? bytes_read : (size - length);
-            memcpy(buf + length, data, remaining_length);
-            length += remaining_length;
-        }
+    if(!lastFileValid || lastFile.u != theFS || lastFile.i_number != inr){
+        lastFileValid = 0;
+        memset(&lastFile, 0, sizeof(struct filev6));
+        int res = filev6_open(theFS, inr, &lastFile);
+        if(res < 0) return res;
+        lastFileValid = 1;
     }
-    return length;
+    struct filev6 *f = &lastFile;
+
+    if(offset < 0 || offset > INT32_MAX) return ERR_OFFSET_OUT_OF_RANGE;
+    if(size > INT32_MAX) size = INT32_MAX;
+    // any offset: whole sectors go straight into buf
+    return filev6_pread(f, buf, size, (int32_t) offset);
 }
 
 static struct fuse_operations available_ops = {
@@ -198,6 +185,7 @@ int u6fs_fuse_main(struct unix_filesystem *u, const char *mountpoint)
     M_REQUIRE_NON_NULL(mountpoint);
 
     theFS = u;  // /!\ GLOBAL ASSIGNMENT
+    lastFileValid = 0;
     const char *argv[] = {
         "u6fs",
         "-s",               // * `-s` : single threaded operation
@@ -215,6 +203,7 @@ int u6fs_fuse_main(struct unix_filesystem *u, const char *mountpoint)
     utils_print_superblock(theFS);
     int ret = fuse_main(sizeof(argv) / sizeof(char *), argv_alias, &available_ops, NULL);
     theFS = NULL; // /!\ GLOBAL ASSIGNMENT
+    lastFileValid = 0;
     return ret;
 }
 
@@ -222,5 +211,6 @@ int u6fs_fuse_main(struct unix_filesystem *u, const char *mountpoint)
 void fuse_set_fs(struct unix_filesystem *u)
 {
     theFS = u;
+    lastFileValid = 0;
 }
 #endif
@@ -97,7 +97,7 @@ int utils_cat_first_sector(const struct unix_filesystem *u, uint16_t inr){
         else{
             pps_printf("the first sector of data of which contains:\n");
             unsigned char tab[SECTOR_SIZE];
-            int number = filev6_readblock(&f, tab);
+            int number = filev6_pread(&f, tab, SECTOR_SIZE, 0);
             if(number < 0){
                 return number;
             }
@@ -113,6 +113,26 @@ int utils_cat_first_sector(const struct unix_filesystem *u, uint16_t inr){
     return res;
 }
 
+/**
+ * @brief print to stdout the SHA256 digest of the first UTILS_HASHED_LENGTH bytes of an open file
+ * @param f - the file (its cursor is not used)
+ * @return 0 on success, <0 on error
+ */
+static int utils_print_sha_filev6(struct filev6 *f){
+    if (f->i_node.i_mode & IFDIR){
+        pps_printf("SHA inode %d: %s\n", f->i_number, SHORT_DIR_NAME);
+        return ERR_NONE;
+    }
+    unsigned char buffer[UTILS_HASHED_LENGTH];
+    const int length = filev6_pread(f, buffer, UTILS_HASHED_LENGTH, 0);
+    if(length < 0){
+        return length;
+    }
+    pps_printf("SHA inode %d: ", f->i_number);
+    utils_print_SHA_buffer(buffer, (size_t) length);
+    return ERR_NONE;
+}
+
 /**
  * @brief print to stdout the SHA256 digest of the first UTILS_HASHED_LENGTH bytes of the file
  * @param u - the mounted filesystem
@@ -125,32 +145,7 @@ int utils_print_shafile(const struct unix_filesystem *u, uint16_t inr){
     memset(&f, 0, sizeof(struct filev6));
     int err = filev6_open(u, inr, &f);
     if(err == ERR_NONE){
-        if (f.i_node.i_mode & IFDIR){
-            pps_printf("SHA inode %d: %s\n", inr, SHORT_DIR_NAME);
-            return ERR_NONE;
-        }
-        else{
-            unsigned char buffer[UTILS_HASHED_LENGTH];
-            size_t length = 0;
-            int res = SECTOR_SIZE;
-            while(res == SECTOR_SIZE && length < UTILS_HASHED_LENGTH){
-                res = filev6_readblock(&f, buffer + length);
-                if(res == SECTOR_SIZE){
-                    if(length + SECTOR_SIZE > UTILS_HASHED_LENGTH){
-                        length = UTILS_HASHED_LENGTH;
-                    }else{
-                        length += SECTOR_SIZE;
-                    }
-                }else if(res < 0){
-                    return res;
-                }else{
-                    length += res;
-                }
-            }
-            pps_printf("SHA inode %d: ", inr);
-            utils_print_SHA_buffer(buffer,length);
-            return ERR_NONE;
-        }
+        return utils_print_sha_filev6(&f);
     }else{
         return err;
     }
@@ -165,22 +160,33 @@ int utils_print_shafile(const struct unix_filesystem *u, uint16_t inr){
 int utils_print_sha_allfiles(const struct unix_filesystem *u){
     M_REQUIRE_NON_NULL(u);
     pps_printf("Listing inodes SHA\n");
-    for(size_t i = ROOT_INUMBER; i < (u->s).s_isize * INODES_PER_SECTOR;++i){
-        int err = utils_print_shafile(u, i);
-        if(err != ERR_UNALLOCATED_INODE && err != ERR_NONE){
-            return err;
-        }
+    // a single pass over the inode table: each inode is read once, with its sector
+    struct inode_iter it;
+    int err = inode_iter_init(u, &it);
+    if(err != ERR_NONE) return err;
+    uint16_t inr = 0;
+    struct inode inode;
+    struct filev6 f;
+    memset(&f, 0, sizeof(struct filev6));
+    while((err = inode_iter_next(&it, &inr, &inode)) > 0){
+        filev6_open_inode(u, inr, &inode, &f);
+        err = utils_print_sha_filev6(&f);
+        if(err != ERR_NONE) return err;
     }
-    return ERR_NONE;
+    return err;
 }
 
 /**
- * @brief print to stdout the inode and sector bitmaps
+ * @brief print to stdout the inode and sector bitmaps (built first if the
+ *        filesystem was mounted with MOUNTV6_LAZY)
  * @param u - the mounted filesystem
  * @return 0 on success, <0 on error
  */
-int utils_print_bitmaps(const struct unix_filesystem *u){
+int utils_print_bitmaps(struct unix_filesystem *u){
     M_REQUIRE_NON_NULL(u);
+    // lazily mounted: build them now
+    int err = mountv6_bitmaps(u);
+    if(err != ERR_NONE) return err;
     bm_print("INODES",u->ibm);
     bm_print("SECTORS", u->fbm);
     return ERR_NONE;
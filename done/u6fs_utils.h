@@ -69,9 +69,10 @@ int utils_print_sha_allfiles(const struct unix_filesystem *u);
  * TODO WEEK 10										   *
  * *************************************************** */
 /**
- * @brief print to stdout the inode and sector bitmaps
+ * @brief print to stdout the inode and sector bitmaps (built first if the
+ *        filesystem was mounted with MOUNTV6_LAZY)
  * @param u - the mounted filesystem
  * @return 0 on success, <0 on error
  */
-int utils_print_bitmaps(const struct unix_filesystem *u);
+int utils_print_bitmaps(struct unix_filesystem *u);
 
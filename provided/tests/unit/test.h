@@ -198,3 +198,23 @@ static void create_dump_fs(const char* dest, const char* src) {
     fclose(dest_file);
     fclose(src_file);
 }
+
+/**
+ * @brief create a disk of nb_sectors zero sectors, each holding its own
+ *        number (modulo 256) in its first byte
+ * @return the disk, opened for reading and writing
+ */
+static FILE* create_disk(const char* name, int nb_sectors) {
+    FILE* f = fopen(name, "w+");
+    if(!f) {
+        ck_abort_msg("Could not create dump file %s", name);
+    }
+
+    uint8_t sector[SECTOR_SIZE] = {0};
+    for(int i = 0; i < nb_sectors; ++i){
+        sector[0] = (uint8_t) i;
+        ck_assert(fwrite(sector, SECTOR_SIZE, 1, f) == 1);
+    }
+    fflush(f);
+    return f;
+}
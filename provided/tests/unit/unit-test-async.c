@@ -0,0 +1,105 @@
+#include <check.h>
+#include <stdio.h>
+
+#include "test.h"
+#include "error.h"
+#include "async.h"
+#include "sector.h"
+#include "unixv6fs.h"
+
+#define ASYNC_DISK DATA_DIR "/dump.async.uv6"
+#define NB_SECTORS 64
+
+struct tally {
+	int calls;
+	int sum;
+};
+
+static int count_sector(void* arg, uint32_t sector, void* data, int err){
+	struct tally* t = arg;
+	if(err != ERR_NONE) return err;
+	++t->calls;
+	t->sum += ((uint8_t*) data)[0];
+	return ((uint8_t*) data)[0] == sector ? ERR_NONE : ERR_IO;
+}
+
+static int reject(void* arg, uint32_t sector, void* data, int err){
+	(void) arg; (void) sector; (void) data; (void) err;
+	return ERR_BAD_PARAMETER;
+}
+
+START_TEST(async_null_params){
+	start_test_print;
+
+	ck_assert_ptr_null(async_alloc(-1, 8, 0));
+	ck_assert_ptr_null(async_alloc(0, 0, 0));
+	ck_assert_invalid_arg(async_read(NULL, 0, NULL, NULL, NULL));
+	ck_assert_invalid_arg(async_submit(NULL));
+	ck_assert_invalid_arg(async_wait(NULL));
+
+	end_test_print;
+}
+END_TEST
+
+/**
+ * @brief read every sector through a small queue, then write and read back
+ */
+static void read_write(int flags){
+	FILE* f = create_disk(ASYNC_DISK, NB_SECTORS);
+	struct async_engine* e = async_alloc(fileno(f), 4, flags);
+	ck_assert_ptr_nonnull(e);
+	if(flags & ASYNC_SYNC) ck_assert(!async_is_async(e));
+
+	struct tally t = {0, 0};
+	for(uint32_t i = 0; i < NB_SECTORS; ++i){
+		ck_assert_err_none(async_read(e, i, NULL, count_sector, &t));
+	}
+	ck_assert_err_none(async_wait(e));
+	ck_assert_int_eq(t.calls, NB_SECTORS);
+	ck_assert_int_eq(t.sum, NB_SECTORS * (NB_SECTORS - 1) / 2);
+
+	uint8_t data[SECTOR_SIZE] = {0};
+	uint8_t read[SECTOR_SIZE] = {0};
+	data[0] = 42;
+	ck_assert_err_none(async_write(e, 7, data, NULL, NULL));
+	ck_assert_err_none(async_wait(e));
+	ck_assert_err_none(sector_read(f, 7, read));
+	ck_assert_int_eq(read[0], 42);
+
+	// errors of the transfers and of the callbacks are reported by async_wait()
+	ck_assert_err_none(async_read(e, 2 * NB_SECTORS, read, NULL, NULL));
+	ck_assert_err(async_wait(e), ERR_IO);
+	ck_assert_err_none(async_read(e, 1, read, reject, NULL));
+	ck_assert_err(async_wait(e), ERR_BAD_PARAMETER);
+	ck_assert_err_none(async_wait(e));
+
+	async_free(e);
+	fclose(f);
+	remove(ASYNC_DISK);
+}
+
+START_TEST(async_io_uring){
+	start_test_print;
+	read_write(0);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(async_sync_fallback){
+	start_test_print;
+	read_write(ASYNC_SYNC);
+	end_test_print;
+}
+END_TEST
+
+Suite* async_test_suite(){
+	Suite* s = suite_create("Tests for the async sector I/O engine");
+
+	Add_Test(s, async_null_params);
+	Add_Test(s, async_io_uring);
+	Add_Test(s, async_sync_fallback);
+
+	return s;
+}
+
+TEST_SUITE(async_test_suite)
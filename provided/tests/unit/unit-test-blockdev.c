@@ -0,0 +1,138 @@
+#include <check.h>
+#include <stdio.h>
+
+#include "test.h"
+#include "error.h"
+#include "blockdev.h"
+#include "sector.h"
+#include "unixv6fs.h"
+
+#define BLOCKDEV_DISK DATA_DIR "/dump.blockdev.uv6"
+#define NB_SECTORS 8
+
+/**
+ * @brief the behaviour every backend shares
+ */
+static void check_device(struct blockdev* dev, uint32_t size){
+	ck_assert_ptr_nonnull(dev);
+	ck_assert_int_eq(blockdev_size(dev), size);
+
+	uint8_t data[2 * SECTOR_SIZE] = {0};
+	ck_assert_err_none(blockdev_read(dev, 2, 2, data));
+	ck_assert_int_eq(data[0], 2);
+	ck_assert_int_eq(data[SECTOR_SIZE], 3);
+	ck_assert_err(blockdev_read(dev, size - 1, 2, data), ERR_IO);
+
+	data[0] = 42;
+	ck_assert_err_none(blockdev_write(dev, 5, 1, data));
+	const uint32_t sectors[2] = {5, 1};
+	uint8_t a[SECTOR_SIZE], b[SECTOR_SIZE];
+	void* bufs[2] = {a, b};
+	ck_assert_err_none(blockdev_readv(dev, sectors, bufs, 2));
+	ck_assert_int_eq(a[0], 42);
+	ck_assert_int_eq(b[0], 1);
+	ck_assert_err_none(blockdev_flush(dev));
+}
+
+START_TEST(blockdev_null_params){
+	start_test_print;
+
+	ck_assert_ptr_null(blockdev_file(-1));
+	ck_assert_ptr_null(blockdev_mmap(-1, 1, 1));
+	ck_assert_ptr_null(blockdev_ram(-1, 0, 0));
+	ck_assert_invalid_arg(blockdev_read(NULL, 0, 1, NON_NULL));
+	ck_assert_invalid_arg(blockdev_flush(NULL));
+	ck_assert_int_eq(blockdev_size(NULL), 0);
+	blockdev_close(NULL);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(blockdev_file_backend){
+	start_test_print;
+
+	FILE* f = create_disk(BLOCKDEV_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	ck_assert_ptr_null(dev->mem);
+	check_device(dev, NB_SECTORS);
+	blockdev_close(dev);
+	fclose(f);
+	remove(BLOCKDEV_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(blockdev_mmap_backend){
+	start_test_print;
+
+	FILE* f = create_disk(BLOCKDEV_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_mmap(fileno(f), 2 * NB_SECTORS, 0);
+	ck_assert_ptr_nonnull(dev->mem);
+	// extended to the volume size
+	check_device(dev, 2 * NB_SECTORS);
+	uint8_t read[SECTOR_SIZE] = {0};
+	ck_assert_err_none(sector_read(f, 5, read));
+	ck_assert_int_eq(read[0], 42);
+	blockdev_close(dev);
+
+	dev = blockdev_mmap(fileno(f), NB_SECTORS, 1);
+	ck_assert_err(blockdev_write(dev, 0, 1, read), ERR_IO);
+	blockdev_close(dev);
+	fclose(f);
+	remove(BLOCKDEV_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(blockdev_ram_backend){
+	start_test_print;
+
+	FILE* f = create_disk(BLOCKDEV_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_ram(fileno(f), NB_SECTORS, 0);
+	ck_assert_ptr_nonnull(dev->mem);
+	uint8_t read[SECTOR_SIZE] = {0};
+	uint8_t data[SECTOR_SIZE] = {0};
+	data[0] = 42;
+	ck_assert_err_none(blockdev_write(dev, 5, 1, data));
+	// only in memory until flushed
+	ck_assert_err_none(sector_read(f, 5, read));
+	ck_assert_int_eq(read[0], 5);
+	blockdev_close(dev);
+
+	dev = blockdev_ram(fileno(f), NB_SECTORS, 0);
+	check_device(dev, NB_SECTORS);
+	ck_assert_err_none(sector_read(f, 5, read));
+	ck_assert_int_eq(read[0], 42);
+	blockdev_close(dev);
+
+	// blank RAM disk
+	dev = blockdev_ram(-1, 4, 0);
+	ck_assert_ptr_nonnull(dev);
+	ck_assert_int_eq(blockdev_size(dev), 4);
+	ck_assert_err_none(blockdev_read(dev, 3, 1, read));
+	ck_assert_int_eq(read[0], 0);
+	ck_assert_err_none(blockdev_flush(dev));
+	blockdev_close(dev);
+
+	fclose(f);
+	remove(BLOCKDEV_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+Suite* blockdev_test_suite(){
+	Suite* s = suite_create("Tests for the block devices");
+
+	Add_Test(s, blockdev_null_params);
+	Add_Test(s, blockdev_file_backend);
+	Add_Test(s, blockdev_mmap_backend);
+	Add_Test(s, blockdev_ram_backend);
+
+	return s;
+}
+
+TEST_SUITE(blockdev_test_suite)
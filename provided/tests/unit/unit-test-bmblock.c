@@ -0,0 +1,145 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "error.h"
+#include "bmblock.h"
+#include "mount.h"
+#include "unixv6fs.h"
+
+#define AIW_DISK DATA_DIR "/aiw.uv6"
+
+START_TEST(bmblock_null_params){
+	start_test_print;
+
+	ck_assert_invalid_arg(bm_alloc_next(NULL));
+	ck_assert_invalid_arg(bm_find_run(NULL, 0, 1));
+	ck_assert_invalid_arg(bm_alloc_run(NULL, 1));
+	ck_assert_int_eq(bm_count_free(NULL), 0);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(bmblock_find_next_words){
+	start_test_print;
+
+	// 200 values: the last word is only partly used
+	struct bmblock_array *bm = bm_alloc(10, 209);
+	ck_assert_ptr_nonnull(bm);
+	ck_assert_int_eq(bm_count_free(bm), 200);
+
+	for(uint64_t x = 10; x < 150; ++x) bm_set(bm, x);
+	ck_assert_int_eq(bm_count_free(bm), 60);
+	ck_assert_int_eq(bm_find_next(bm), 150);
+	ck_assert_int_eq(bm->cursor, 2);
+
+	for(uint64_t x = 150; x <= 209; ++x) bm_set(bm, x);
+	ck_assert_int_eq(bm_count_free(bm), 0);
+	ck_assert_int_eq(bm_find_next(bm), ERR_BITMAP_FULL);
+
+	bm_clear(bm, 12);
+	bm_clear(bm, 12);
+	ck_assert_int_eq(bm_count_free(bm), 1);
+	ck_assert_int_eq(bm_find_next(bm), 12);
+
+	free(bm);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(bmblock_alloc_next_fit){
+	start_test_print;
+
+	struct bmblock_array *bm = bm_alloc(1, 1000);
+	ck_assert_ptr_nonnull(bm);
+
+	for(int x = 1; x <= 5; ++x) ck_assert_int_eq(bm_alloc_next(bm), x);
+	// a freed value is only reused once the cursor wraps around
+	bm_clear(bm, 2);
+	ck_assert_int_eq(bm_alloc_next(bm), 6);
+	for(int x = 7; x <= 1000; ++x) ck_assert_int_eq(bm_alloc_next(bm), x);
+	ck_assert_int_eq(bm_alloc_next(bm), 2);
+	ck_assert_int_eq(bm_alloc_next(bm), ERR_BITMAP_FULL);
+	ck_assert_int_eq(bm_count_free(bm), 0);
+
+	free(bm);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(bmblock_runs){
+	start_test_print;
+
+	struct bmblock_array *bm = bm_alloc(0, 511);
+	ck_assert_ptr_nonnull(bm);
+
+	// holes: [0,3), [4,64), [65,200), [300,512)
+	bm_set(bm, 3);
+	bm_set(bm, 64);
+	for(uint64_t x = 200; x < 300; ++x) bm_set(bm, x);
+
+	ck_assert_int_eq(bm_find_run(bm, 0, 3), 0);
+	ck_assert_int_eq(bm_find_run(bm, 0, 4), 4);
+	ck_assert_int_eq(bm_find_run(bm, 0, 61), 65);
+	ck_assert_int_eq(bm_find_run(bm, 70, 130), 70);
+	ck_assert_int_eq(bm_find_run(bm, 0, 136), 300);
+	ck_assert_int_eq(bm_find_run(bm, 0, 212), 300);
+	ck_assert_int_eq(bm_find_run(bm, 0, 213), ERR_BITMAP_FULL);
+	ck_assert_int_eq(bm_find_run(bm, 0, 0), ERR_BAD_PARAMETER);
+
+	const uint64_t free_before = bm_count_free(bm);
+	ck_assert_int_eq(bm_alloc_run(bm, 100), 65);
+	ck_assert_int_eq(bm_count_free(bm), free_before - 100);
+	for(int x = 65; x < 165; ++x) ck_assert_int_eq(bm_get(bm, x), 1);
+	// next fit: the following run starts after the previous one
+	ck_assert_int_eq(bm_alloc_run(bm, 10), 165);
+	ck_assert_int_eq(bm_alloc_run(bm, 30), 300);
+
+	bm_recount(bm);
+	ck_assert_int_eq(bm_count_free(bm), free_before - 140);
+	ck_assert_int_eq(bm_count_free_range(bm, 0, 511), bm_count_free(bm));
+	ck_assert_int_eq(bm_count_free_range(bm, 60, 70), 4);
+	ck_assert_int_eq(bm_count_free_range(bm, 64, 64), 0);
+
+	free(bm);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(bmblock_mount_counts){
+	start_test_print;
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(AIW_DISK, &u));
+
+	// the counts kept by bm_set() match a full popcount
+	const uint64_t ifree = bm_count_free(u.ibm), ffree = bm_count_free(u.fbm);
+	uint64_t used = 0;
+	for(uint64_t x = u.fbm->min; x <= u.fbm->max; ++x) used += bm_get(u.fbm, x) == 1;
+	ck_assert_int_eq(ffree, u.fbm->max - u.fbm->min + 1 - used);
+	bm_recount(u.ibm);
+	bm_recount(u.fbm);
+	ck_assert_int_eq(bm_count_free(u.ibm), ifree);
+	ck_assert_int_eq(bm_count_free(u.fbm), ffree);
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+Suite* bmblock_test_suite(){
+	Suite* s = suite_create("Tests for the bitmap search engine");
+
+	Add_Test(s, bmblock_null_params);
+	Add_Test(s, bmblock_find_next_words);
+	Add_Test(s, bmblock_alloc_next_fit);
+	Add_Test(s, bmblock_runs);
+	Add_Test(s, bmblock_mount_counts);
+
+	return s;
+}
+
+TEST_SUITE(bmblock_test_suite)
@@ -0,0 +1,137 @@
+#define _XOPEN_SOURCE 700 // nftw()
+#include <check.h>
+#include <stdio.h>
+#include <ftw.h>
+
+#include "test.h"
+#include "error.h"
+#include "u6fs_bulk.h"
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "mount.h"
+
+#define SIMPLE_DISK DATA_DIR "/simple.uv6"
+#define AIW_TREE DATA_DIR "/aiw"
+#define AIW_DISK DATA_DIR "/aiw.uv6"
+#define BULK_DISK DATA_DIR "/dump.bulk.uv6"
+#define BULK_DIR DATA_DIR "/dump.bulk"
+
+/**
+ * @brief check that a file of the filesystem holds the same bytes as a host file
+ */
+static void assert_same_content(struct unix_filesystem *u, const char *path, const char *hostpath){
+	static char expected[(ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE];
+	static char read[sizeof(expected)];
+	FILE *f = fopen(hostpath, "rb");
+	ck_assert_ptr_nonnull(f);
+	const size_t size = fread(expected, 1, sizeof(expected), f);
+	fclose(f);
+
+	const int inr = direntv6_dirlookup(u, ROOT_INUMBER, path);
+	ck_assert(inr > 0);
+	struct filev6 fv6;
+	ck_assert_err_none(filev6_open(u, (uint16_t) inr, &fv6));
+	ck_assert_int_eq(filev6_pread(&fv6, read, sizeof(read), 0), size);
+	ck_assert_mem_eq(read, expected, size);
+}
+
+START_TEST(bulk_import_null_params){
+	start_test_print;
+
+	ck_assert_invalid_arg(bulk_import(NULL, NON_NULL, NON_NULL));
+	ck_assert_invalid_arg(bulk_import(NON_NULL, NULL, NON_NULL));
+	ck_assert_invalid_arg(bulk_import(NON_NULL, NON_NULL, NULL));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(bulk_import_tree){
+	start_test_print;
+
+	create_dump_fs(BULK_DISK, SIMPLE_DISK);
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(BULK_DISK, &u));
+	ck_assert_err(bulk_import(&u, DATA_DIR "/no_such_dir", "/aiw"), ERR_NO_SUCH_FILE);
+	ck_assert_err_none(bulk_import(&u, AIW_TREE, "/aiw"));
+	// the same entries cannot be imported twice
+	ck_assert_err(bulk_import(&u, AIW_TREE, "/aiw"), ERR_FILENAME_ALREADY_EXISTS);
+	ck_assert_err_none(umountv6(&u));
+
+	ck_assert_err_none(mountv6(BULK_DISK, &u));
+	assert_same_content(&u, "/aiw/books/aiw/full/11-0.txt", AIW_TREE "/books/aiw/full/11-0.txt");
+	assert_same_content(&u, "/aiw/books/aiw/by_chapters/11-0-c07.txt", AIW_TREE "/books/aiw/by_chapters/11-0-c07.txt");
+	assert_same_content(&u, "/tmp/coucou.txt", DATA_DIR "/simple/tmp/coucou.txt");
+
+	// the entries of a directory get consecutive inodes, in name order
+	const int first = direntv6_dirlookup(&u, ROOT_INUMBER, "/aiw/books/aiw/by_chapters/00-licence.txt");
+	const int last = direntv6_dirlookup(&u, ROOT_INUMBER, "/aiw/books/aiw/by_chapters/11-0-end.txt");
+	ck_assert(first > 0);
+	ck_assert_int_eq(last - first, 14);
+	ck_assert_err_none(umountv6(&u));
+
+	remove(BULK_DISK);
+	end_test_print;
+}
+END_TEST
+
+/**
+ * @brief check that two host files hold the same bytes
+ */
+static void assert_same_host_file(const char *a, const char *b){
+	static char x[(ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE];
+	static char y[sizeof(x)];
+	FILE *f = fopen(a, "rb");
+	ck_assert_ptr_nonnull(f);
+	const size_t nx = fread(x, 1, sizeof(x), f);
+	fclose(f);
+	f = fopen(b, "rb");
+	ck_assert_ptr_nonnull(f);
+	const size_t ny = fread(y, 1, sizeof(y), f);
+	fclose(f);
+	ck_assert_int_eq(nx, ny);
+	ck_assert_mem_eq(x, y, nx);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw){
+	(void) st; (void) flag; (void) ftw;
+	return remove(path);
+}
+
+START_TEST(bulk_export_tree){
+	start_test_print;
+
+	ck_assert_invalid_arg(bulk_export(NULL, NON_NULL, NON_NULL));
+	ck_assert_invalid_arg(bulk_export(NON_NULL, NULL, NON_NULL));
+	ck_assert_invalid_arg(bulk_export(NON_NULL, NON_NULL, NULL));
+
+	struct unix_filesystem u;
+	struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+	opts.flags = MOUNTV6_RDONLY | MOUNTV6_LAZY;
+	ck_assert_err_none(mountv6_opt(AIW_DISK, &u, &opts));
+	ck_assert_err(bulk_export(&u, "/no/such/dir", BULK_DIR), ERR_NO_SUCH_FILE);
+
+	// a subtree, into a new host directory
+	ck_assert_err_none(bulk_export(&u, "/books/aiw", BULK_DIR));
+	assert_same_host_file(BULK_DIR "/full/11-0.txt", AIW_TREE "/books/aiw/full/11-0.txt");
+	assert_same_host_file(BULK_DIR "/by_chapters/00-licence.txt", AIW_TREE "/books/aiw/by_chapters/00-licence.txt");
+	assert_same_host_file(BULK_DIR "/by_chapters/11-0-c12.txt", AIW_TREE "/books/aiw/by_chapters/11-0-c12.txt");
+	ck_assert_err_none(umountv6(&u));
+
+	ck_assert_int_eq(nftw(BULK_DIR, remove_entry, 16, FTW_DEPTH | FTW_PHYS), 0);
+	end_test_print;
+}
+END_TEST
+
+Suite* bulk_test_suite(){
+	Suite* s = suite_create("Tests for the bulk transfers");
+
+	Add_Test(s, bulk_import_null_params);
+	Add_Test(s, bulk_import_tree);
+	Add_Test(s, bulk_export_tree);
+
+	return s;
+}
+
+TEST_SUITE(bulk_test_suite)
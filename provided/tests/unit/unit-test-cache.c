@@ -0,0 +1,194 @@
+#include <check.h>
+#include <stdio.h>
+
+#include "test.h"
+#include "error.h"
+#include "cache.h"
+#include "sector.h"
+#include "unixv6fs.h"
+
+#define CACHE_DISK DATA_DIR "/dump.cache.uv6"
+#define NB_SECTORS 16
+
+START_TEST(cache_null_params){
+	start_test_print;
+
+	ck_assert_ptr_null(cache_alloc(NULL, SECTOR_SIZE, 0));
+	ck_assert_invalid_arg(cache_read(NULL, 0, NON_NULL));
+	ck_assert_invalid_arg(cache_write(NULL, 0, NON_NULL));
+	ck_assert_invalid_arg(cache_flush(NULL));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(cache_too_small){
+	start_test_print;
+
+	FILE* f = create_disk(CACHE_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	ck_assert_ptr_null(cache_alloc(dev, SECTOR_SIZE - 1, 0));
+	blockdev_close(dev);
+	fclose(f);
+	remove(CACHE_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(cache_read_hits_and_misses){
+	start_test_print;
+
+	FILE* f = create_disk(CACHE_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	struct sector_cache* c = cache_alloc(dev, 4 * SECTOR_SIZE, 0);
+	ck_assert_ptr_nonnull(c);
+
+	uint8_t data[SECTOR_SIZE] = {0};
+	for(int round = 0; round < 2; ++round){
+		for(uint32_t i = 0; i < 4; ++i){
+			ck_assert_err_none(cache_read(c, i, data));
+			ck_assert_int_eq(data[0], i);
+		}
+	}
+	ck_assert_int_eq(c->stats.misses, 4);
+	ck_assert_int_eq(c->stats.hits, 4);
+
+	// more sectors than slots: evictions, but always the right content
+	for(uint32_t i = 0; i < NB_SECTORS; ++i){
+		ck_assert_err_none(cache_read(c, i, data));
+		ck_assert_int_eq(data[0], i);
+	}
+	ck_assert_int_eq(c->stats.evictions, NB_SECTORS - 4);
+	ck_assert_int_eq(cache_read(c, 2 * NB_SECTORS, data), ERR_IO);
+
+	cache_free(c);
+	blockdev_close(dev);
+	fclose(f);
+	remove(CACHE_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(cache_write_back){
+	start_test_print;
+
+	FILE* f = create_disk(CACHE_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	struct sector_cache* c = cache_alloc(dev, 2 * SECTOR_SIZE, 1);
+	ck_assert_ptr_nonnull(c);
+
+	uint8_t data[SECTOR_SIZE] = {0};
+	uint8_t read[SECTOR_SIZE] = {0};
+	data[0] = 42;
+	ck_assert_err_none(cache_write(c, 3, data));
+
+	// not on disk yet, but visible through the cache
+	ck_assert_err_none(sector_read(f, 3, read));
+	ck_assert_int_eq(read[0], 3);
+	ck_assert_err_none(cache_read(c, 3, read));
+	ck_assert_int_eq(read[0], 42);
+
+	ck_assert_err_none(cache_flush(c));
+	ck_assert_err_none(sector_read(f, 3, read));
+	ck_assert_int_eq(read[0], 42);
+	ck_assert_int_eq(c->stats.writebacks, 1);
+
+	// eviction of a dirty sector writes it back
+	data[0] = 43;
+	ck_assert_err_none(cache_write(c, 5, data));
+	for(uint32_t i = 6; i < 10; ++i){
+		ck_assert_err_none(cache_read(c, i, read));
+	}
+	ck_assert_err_none(sector_read(f, 5, read));
+	ck_assert_int_eq(read[0], 43);
+
+	cache_free(c);
+	blockdev_close(dev);
+	fclose(f);
+	remove(CACHE_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(cache_write_through){
+	start_test_print;
+
+	FILE* f = create_disk(CACHE_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	struct sector_cache* c = cache_alloc(dev, 2 * SECTOR_SIZE, 0);
+	ck_assert_ptr_nonnull(c);
+
+	uint8_t data[SECTOR_SIZE] = {0};
+	uint8_t read[SECTOR_SIZE] = {0};
+	data[0] = 42;
+	ck_assert_err_none(cache_write(c, 3, data));
+	ck_assert_err_none(sector_read(f, 3, read));
+	ck_assert_int_eq(read[0], 42);
+	ck_assert_err_none(cache_flush(c));
+	ck_assert_int_eq(c->stats.writebacks, 0);
+
+	cache_free(c);
+	blockdev_close(dev);
+	fclose(f);
+	remove(CACHE_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(cache_vectored){
+	start_test_print;
+
+	FILE* f = create_disk(CACHE_DISK, NB_SECTORS);
+	struct blockdev* dev = blockdev_file(fileno(f));
+	struct sector_cache* c = cache_alloc(dev, 8 * SECTOR_SIZE, 0);
+	ck_assert_ptr_nonnull(c);
+
+	uint8_t data[4][SECTOR_SIZE];
+	void* bufs[4] = {data[0], data[1], data[2], data[3]};
+	const uint32_t sectors[4] = {2, 3, 4, 9};
+	ck_assert_err_none(cache_read(c, 3, data[0]));
+	ck_assert_err_none(cache_readv(c, sectors, bufs, 4));
+	for(int i = 0; i < 4; ++i){
+		ck_assert_int_eq(data[i][0], sectors[i]);
+	}
+	ck_assert_int_eq(c->stats.hits, 1);
+	ck_assert_int_eq(c->stats.misses, 4);
+
+	// write-through: on disk at once, and cached
+	data[0][0] = 42;
+	data[1][0] = 43;
+	const void* wbufs[2] = {data[0], data[1]};
+	ck_assert_err_none(cache_writev(c, sectors, wbufs, 2));
+	uint8_t read[SECTOR_SIZE] = {0};
+	ck_assert_err_none(sector_read(f, 3, read));
+	ck_assert_int_eq(read[0], 43);
+	ck_assert_err_none(cache_readv(c, sectors, bufs, 2));
+	ck_assert_int_eq(c->stats.misses, 4);
+
+	cache_free(c);
+	blockdev_close(dev);
+	fclose(f);
+	remove(CACHE_DISK);
+
+	end_test_print;
+}
+END_TEST
+
+Suite* cache_test_suite(){
+	Suite* s = suite_create("Tests for the sector cache");
+
+	Add_Test(s, cache_null_params);
+	Add_Test(s, cache_too_small);
+	Add_Test(s, cache_read_hits_and_misses);
+	Add_Test(s, cache_write_back);
+	Add_Test(s, cache_write_through);
+	Add_Test(s, cache_vectored);
+
+	return s;
+}
+
+TEST_SUITE(cache_test_suite)
@@ -7,6 +7,7 @@
 #include "sector.h"
 #include "mount.h"
 #include "filev6.h"
+#include "cache.h"
 
 #define SIMPLE_DISK DATA_DIR "/simple.uv6"
 #define AIW_DISK DATA_DIR "/aiw.uv6"
@@ -392,6 +393,279 @@ START_TEST(filev6_writebytes_multiple_sectors) {
 }
 END_TEST
 
+START_TEST(filev6_prealloc_contiguous) {
+	start_test_print;
+
+	ck_assert_invalid_arg(filev6_prealloc(NULL, 1));
+	create_dump_fs(DATA_DIR "/dump.filev6_prealloc_contiguous.uv6", SIMPLE_DISK);
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(DATA_DIR "/dump.filev6_prealloc_contiguous.uv6", &u));
+
+	// a one-sector hole where the first free sector is
+	const int hole = bm_find_next(u.fbm);
+	ck_assert(hole > 0);
+	bm_set(u.fbm, hole + 1);
+	const uint64_t free_before = bm_count_free(u.fbm);
+
+	struct filev6 file;
+	ck_assert_err_none(filev6_create(&u, IREAD | IWRITE, &file));
+	char buf[6 * SECTOR_SIZE - 100];
+	memset(buf, 'x', sizeof(buf));
+	ck_assert_err_none(filev6_writebytes(&file, buf, sizeof(buf)));
+
+	// the file does not start in the hole, and its sectors follow each other
+	ck_assert(file.i_node.i_addr[0] > hole + 1);
+	for(int i = 1; i < 6; ++i){
+		ck_assert_int_eq(file.i_node.i_addr[i], file.i_node.i_addr[0] + i);
+	}
+	// nothing reserved is left behind
+	ck_assert_int_eq(bm_count_free(u.fbm), free_before - 6);
+	ck_assert_int_eq(file.pa_data, file.pa_data_end);
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_flush_deferred_inode) {
+	start_test_print;
+
+	ck_assert_invalid_arg(filev6_flush(NULL));
+	ck_assert_invalid_arg(filev6_close(NULL));
+	create_dump_fs(DATA_DIR "/dump.filev6_flush_deferred_inode.uv6", SIMPLE_DISK);
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(DATA_DIR "/dump.filev6_flush_deferred_inode.uv6", &u));
+	ck_assert_ptr_nonnull(u.icache);
+
+	struct filev6 file;
+	ck_assert_err_none(filev6_open(&u, 3, &file));
+	char buf[7 * SECTOR_SIZE];
+	memset(buf, 'y', sizeof(buf));
+
+	// seven sectors written, the inode not once
+	const uint64_t writebacks = u.icache->stats.writebacks;
+	ck_assert_err_none(filev6_writebytes(&file, buf, sizeof(buf)));
+	ck_assert_int_eq(file.dirty, 1);
+	ck_assert_int_eq(u.icache->stats.writebacks, writebacks);
+	struct inode_sector table;
+	ck_assert_err_none(sector_read(u.f, u.s.s_inode_start, &table));
+	ck_assert_int_eq(inode_getsize(&table.inodes[3]), 18);
+
+	// then once, with the final size
+	ck_assert_err_none(filev6_close(&file));
+	ck_assert_int_eq(file.dirty, 0);
+	ck_assert_int_eq(u.icache->stats.writebacks, writebacks + 1);
+	ck_assert_err_none(filev6_flush(&file));
+	ck_assert_int_eq(u.icache->stats.writebacks, writebacks + 1);
+	ck_assert_err_none(sector_read(u.f, u.s.s_inode_start, &table));
+	ck_assert_int_eq(inode_getsize(&table.inodes[3]), 18 + sizeof(buf));
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_writebytes_aligned_span) {
+	start_test_print;
+
+	create_dump_fs(DATA_DIR "/dump.filev6_writebytes_aligned_span.uv6", SIMPLE_DISK);
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(DATA_DIR "/dump.filev6_writebytes_aligned_span.uv6", &u));
+	ck_assert_ptr_nonnull(u.cache);
+
+	// 18 bytes in the file: head of 494 bytes, 2 whole sectors, tail of 118 bytes
+	char buf[3 * SECTOR_SIZE + 100];
+	for(size_t i = 0; i < sizeof(buf); ++i) buf[i] = (char) ('a' + i % 26);
+	struct filev6 file;
+	ck_assert_err_none(filev6_open(&u, 3, &file));
+	const uint64_t misses = u.cache->stats.misses;
+	ck_assert_err_none(filev6_writebytes(&file, buf, sizeof(buf)));
+	ck_assert_int_eq(inode_getsize(&file.i_node), 18 + sizeof(buf));
+
+	// nothing but the head sector was read
+	ck_assert(u.cache->stats.misses <= misses + 1);
+	char sector[SECTOR_SIZE];
+	for(int i = 1; i < 4; ++i){
+		ck_assert_err_none(sector_read(u.f, file.i_node.i_addr[i], sector));
+		const size_t off = (size_t) i * SECTOR_SIZE - 18;
+		const size_t n = i < 3 ? SECTOR_SIZE : sizeof(buf) - off;
+		ck_assert_mem_eq(sector, buf + off, n);
+	}
+	ck_assert_err_none(sector_read(u.f, file.i_node.i_addr[0], sector));
+	ck_assert_mem_eq(sector + 18, buf, SECTOR_SIZE - 18);
+	ck_assert_err_none(filev6_close(&file));
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_writebytes_large_file) {
+	start_test_print;
+
+	const char *disk = DATA_DIR "/dump.filev6_writebytes_large_file.uv6";
+	create_dump_fs(disk, SIMPLE_DISK);
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(disk, &u));
+
+	// 3 sectors, then up to 300 sectors and 100 bytes: the file becomes large
+	// (first indirect sector), then needs a second indirect sector
+	static char buf[300 * SECTOR_SIZE + 100];
+	for(size_t i = 0; i < sizeof(buf); ++i) buf[i] = (char) ('A' + i % 53);
+	struct filev6 file;
+	ck_assert_err_none(filev6_create(&u, 0, &file));
+	ck_assert_err_none(filev6_writebytes(&file, buf, 3 * SECTOR_SIZE));
+	ck_assert_err_none(filev6_writebytes(&file, buf + 3 * SECTOR_SIZE, 1000));
+	ck_assert_err_none(filev6_writebytes(&file, buf + 3 * SECTOR_SIZE + 1000, sizeof(buf) - 3 * SECTOR_SIZE - 1000));
+	ck_assert_int_eq(inode_getsize(&file.i_node), sizeof(buf));
+	ck_assert_int_eq(file.map_dirty, 3);
+	ck_assert_int_eq(file.i_node.i_addr[2], 0);
+
+	// the indirect sectors reach the disk together with the inode
+	ck_assert_err_none(filev6_close(&file));
+	ck_assert_int_eq(file.map_dirty, 0);
+	const uint16_t inr = file.i_number;
+	ck_assert_err_none(umountv6(&u));
+
+	ck_assert_err_none(mountv6(disk, &u));
+	ck_assert_err_none(filev6_open(&u, inr, &file));
+	static char read[sizeof(buf)];
+	ck_assert_int_eq(filev6_pread(&file, read, sizeof(read), 0), sizeof(buf));
+	ck_assert_mem_eq(read, buf, sizeof(buf));
+	ck_assert_err_none(umountv6(&u));
+
+	remove(disk);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_findsector_block_map) {
+	start_test_print;
+
+	ck_assert_invalid_arg(filev6_findsector(NULL, 0));
+
+	struct unix_filesystem fs = {0};
+	ck_assert_err_none(mountv6(AIW_DISK, &fs));
+
+	struct filev6 f = {0};
+	ck_assert_err_none(filev6_open(&fs, 5, &f));
+	ck_assert_int_eq(f.map_valid, 0);
+
+	int expected[34];
+	for(int32_t off = 0; off < 34; ++off){
+		expected[off] = inode_findsector(&fs, &f.i_node, off);
+	}
+
+	// the indirect sector is read once...
+	ck_assert_int_eq(filev6_findsector(&f, 0), 71);
+	ck_assert_int_eq(f.map_valid, 1);
+
+	// ... then the whole file maps without metadata I/O
+	const uint64_t accesses = fs.cache->stats.hits + fs.cache->stats.misses;
+	for(int32_t off = 33; off >= 0; --off){
+		ck_assert_int_eq(filev6_findsector(&f, off), expected[off]);
+	}
+	ck_assert_int_eq(filev6_findsector(&f, 34), ERR_OFFSET_OUT_OF_RANGE);
+	ck_assert(fs.cache->stats.hits + fs.cache->stats.misses == accesses);
+
+	ck_assert_err_none(umountv6(&fs));
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_readahead) {
+	start_test_print;
+
+	struct unix_filesystem fs = {0};
+	ck_assert_err_none(mountv6(AIW_DISK, &fs));
+	ck_assert_ptr_nonnull(fs.cache);
+
+	struct filev6 f = {0};
+	ck_assert_err_none(filev6_open(&fs, 5, &f));
+
+	// the first read is sequential: the window opens...
+	char block[SECTOR_SIZE] = {0};
+	ck_assert_int_eq(filev6_readblock(&f, block), SECTOR_SIZE);
+	ck_assert_uint_eq(f.ra_window, FILEV6_RA_MIN);
+	ck_assert_int_eq(f.ra_end, 1 + FILEV6_RA_MIN);
+	const uint64_t prefetched = fs.cache->stats.prefetched;
+	ck_assert(prefetched >= FILEV6_RA_MIN);
+
+	// ... and the next sectors are served from the cache
+	const uint64_t misses = fs.cache->stats.misses;
+	for(int i = 1; i < FILEV6_RA_MIN; ++i){
+		ck_assert_int_eq(filev6_readblock(&f, block), SECTOR_SIZE);
+	}
+	ck_assert_uint_eq(fs.cache->stats.misses, misses);
+
+	// reading on grows the window, up to its maximum
+	int read = 0;
+	while((read = filev6_readblock(&f, block)) == SECTOR_SIZE);
+	ck_assert_int_eq(read, 489);
+	ck_assert(f.ra_window > FILEV6_RA_MIN);
+	ck_assert(f.ra_window <= FILEV6_RA_MAX);
+	ck_assert_uint_eq(fs.cache->stats.misses, misses);
+
+	// a random access resets it
+	ck_assert_err_none(filev6_lseek(&f, 4 * SECTOR_SIZE));
+	ck_assert_int_eq(filev6_readblock(&f, block), SECTOR_SIZE);
+	ck_assert_uint_eq(f.ra_window, 0);
+	ck_assert_int_eq(filev6_readblock(&f, block), SECTOR_SIZE);
+	ck_assert_uint_eq(f.ra_window, FILEV6_RA_MIN);
+
+	ck_assert_err_none(umountv6(&fs));
+	end_test_print;
+}
+END_TEST
+
+START_TEST(filev6_pread_any_offset) {
+	start_test_print;
+
+	ck_assert_invalid_arg(filev6_pread(NULL, NON_NULL, 1, 0));
+	ck_assert_invalid_arg(filev6_pread(NON_NULL, NULL, 1, 0));
+
+	struct unix_filesystem fs = {0};
+	ck_assert_err_none(mountv6(AIW_DISK, &fs));
+
+	// the reference: the whole file (17385 bytes), sector by sector
+	struct filev6 f = {0};
+	ck_assert_err_none(filev6_open(&fs, 5, &f));
+	static char whole[34 * SECTOR_SIZE];
+	int length = 0;
+	int read = 0;
+	while((read = filev6_readblock(&f, whole + length)) > 0) length += read;
+	ck_assert_int_eq(length, 17385);
+
+	// unaligned head, whole sectors and tail; the cursor does not move
+	static char buf[34 * SECTOR_SIZE];
+	const int32_t offsets[] = { 0, 1, 511, 512, 1000, 17000, 17384 };
+	const size_t lengths[] = { 1, 100, 512, 1300, 5 * SECTOR_SIZE + 7, sizeof(buf) };
+	for(size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i){
+		for(size_t j = 0; j < sizeof(lengths) / sizeof(lengths[0]); ++j){
+			const int expected = 17385 - offsets[i] < (int) lengths[j] ? 17385 - offsets[i] : (int) lengths[j];
+			ck_assert_int_eq(filev6_pread(&f, buf, lengths[j], offsets[i]), expected);
+			ck_assert_mem_eq(buf, whole + offsets[i], (size_t) expected);
+			ck_assert_int_eq(f.offset, 17385);
+		}
+	}
+
+	// at or beyond the end of file
+	ck_assert_int_eq(filev6_pread(&f, buf, 10, 17385), 0);
+	ck_assert_int_eq(filev6_pread(&f, buf, 10, 20000), 0);
+	ck_assert_err(filev6_pread(&f, buf, 10, -1), ERR_OFFSET_OUT_OF_RANGE);
+
+	ck_assert_err_none(umountv6(&fs));
+	end_test_print;
+}
+END_TEST
+
 Suite* filev6_test_suite() {
 	Suite* s = suite_create("Tests for filev6 layer");
 
@@ -406,6 +680,9 @@ Suite* filev6_test_suite() {
 	Add_Test(s,  filev6_readblock_file_too_large);
 	Add_Test(s,  filev6_readblock_valid);
 	Add_Test(s,  filev6_readblock_eof);
+	Add_Test(s,  filev6_readahead);
+	Add_Test(s,  filev6_findsector_block_map);
+	Add_Test(s,  filev6_pread_any_offset);
 
 	Add_Test(s,  filev6_lseek_null_param);
 	Add_Test(s,  filev6_lseek_out_of_range);
@@ -417,6 +694,10 @@ Suite* filev6_test_suite() {
 	Add_Test(s,  filev6_writebytes_null_params);
 	Add_Test(s,  filev6_writebytes_single_sector);
 	Add_Test(s,  filev6_writebytes_multiple_sectors);
+	Add_Test(s,  filev6_prealloc_contiguous);
+	Add_Test(s,  filev6_flush_deferred_inode);
+	Add_Test(s,  filev6_writebytes_aligned_span);
+	Add_Test(s,  filev6_writebytes_large_file);
 
 	return s;
 }
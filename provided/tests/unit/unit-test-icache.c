@@ -0,0 +1,135 @@
+#include <check.h>
+#include <stdio.h>
+
+#include "test.h"
+#include "error.h"
+#include "icache.h"
+#include "inode.h"
+#include "sector.h"
+#include "mount.h"
+#include "unixv6fs.h"
+
+#define SIMPLE_DISK DATA_DIR "/simple.uv6"
+#define AIW_DISK DATA_DIR "/aiw.uv6"
+#define ICACHE_DISK DATA_DIR "/dump.icache.uv6"
+
+START_TEST(icache_null_params){
+	start_test_print;
+
+	ck_assert_ptr_null(icache_alloc(NULL, ICACHE_DEFAULT_SIZE, 0));
+	ck_assert_ptr_null(icache_alloc(NON_NULL, sizeof(struct icache_entry) - 1, 0));
+	ck_assert_invalid_arg(icache_read(NULL, 1, NON_NULL));
+	ck_assert_invalid_arg(icache_read(NON_NULL, 1, NULL));
+	ck_assert_invalid_arg(icache_write(NULL, 1, NON_NULL));
+	ck_assert_invalid_arg(icache_flush(NULL));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(icache_primed_by_mount){
+	start_test_print;
+
+	struct unix_filesystem u;
+	ck_assert_err_none(mountv6(AIW_DISK, &u));
+	ck_assert_ptr_nonnull(u.icache);
+
+	// the whole inode table was read to build the bitmaps: no inode read misses
+	struct inode in;
+	for(uint16_t inr = ROOT_INUMBER; inr < u.s.s_isize * INODES_PER_SECTOR; ++inr){
+		const int err = inode_read(&u, inr, &in);
+		ck_assert(err == ERR_NONE || err == ERR_UNALLOCATED_INODE);
+	}
+	ck_assert_int_eq(u.icache->stats.misses, 0);
+	ck_assert_int_eq(inode_read(&u, 5, &in), ERR_NONE);
+	ck_assert_int_eq(inode_getsize(&in), 17385);
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+START_TEST(icache_miss_loads_sector){
+	start_test_print;
+
+	struct unix_filesystem u;
+	struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+	opts.icache_size = 4 * INODES_PER_SECTOR * sizeof(struct icache_entry);
+	ck_assert_err_none(mountv6_opt(SIMPLE_DISK, &u, &opts));
+
+	// beyond what the mount could prime: one miss for the whole sector
+	const uint16_t inr = 8 * INODES_PER_SECTOR;
+	struct inode in;
+	ck_assert_int_eq(inode_read(&u, inr, &in), ERR_UNALLOCATED_INODE);
+	ck_assert_int_eq(u.icache->stats.misses, 1);
+	for(uint16_t i = 1; i < INODES_PER_SECTOR; ++i){
+		ck_assert_int_eq(inode_read(&u, inr + i, &in), ERR_UNALLOCATED_INODE);
+	}
+	ck_assert_int_eq(u.icache->stats.misses, 1);
+
+	ck_assert_err_none(umountv6(&u));
+
+	end_test_print;
+}
+END_TEST
+
+/**
+ * @brief write inode 3 and check when it reaches the image
+ */
+static void write_inode(int flags){
+	create_dump_fs(ICACHE_DISK, SIMPLE_DISK);
+
+	struct unix_filesystem u;
+	struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+	opts.flags = flags;
+	ck_assert_err_none(mountv6_opt(ICACHE_DISK, &u, &opts));
+
+	struct inode in, read_inode;
+	ck_assert_err_none(inode_read(&u, 3, &in));
+	in.i_addr[2] = 123;
+	ck_assert_err_none(inode_write(&u, 3, &in));
+	ck_assert_err_none(inode_read(&u, 3, &read_inode));
+	ck_assert_inode_eq(in, read_inode);
+
+	// write-back: the image is only updated by umountv6()
+	struct inode_sector table;
+	ck_assert_err_none(sector_read(u.f, u.s.s_inode_start, &table));
+	ck_assert_int_eq(table.inodes[3].i_addr[2] == 123, !(flags & MOUNTV6_WRITEBACK));
+	ck_assert_err_none(umountv6(&u));
+
+	ck_assert_err_none(mountv6(ICACHE_DISK, &u));
+	ck_assert_err_none(inode_read(&u, 3, &read_inode));
+	ck_assert_inode_eq(in, read_inode);
+	ck_assert_err_none(umountv6(&u));
+
+	remove(ICACHE_DISK);
+}
+
+START_TEST(icache_write_through){
+	start_test_print;
+	write_inode(0);
+	end_test_print;
+}
+END_TEST
+
+START_TEST(icache_write_back){
+	start_test_print;
+	write_inode(MOUNTV6_WRITEBACK);
+	end_test_print;
+}
+END_TEST
+
+Suite* icache_test_suite(){
+	Suite* s = suite_create("Tests for the inode cache");
+
+	Add_Test(s, icache_null_params);
+	Add_Test(s, icache_primed_by_mount);
+	Add_Test(s, icache_miss_loads_sector);
+	Add_Test(s, icache_write_through);
+	Add_Test(s, icache_write_back);
+
+	return s;
+}
+
+TEST_SUITE(icache_test_suite)
@@ -1,8 +1,10 @@
 #include <check.h>
 #include <stddef.h> // offsetof
 #include <stdio.h>
+#include <stdlib.h>
 #include "test.h"
 #include "inode.h"
+#include "mount.h"
 
 #define SIMPLE_DISK DATA_DIR "/simple.uv6"
 #define AIW_DISK DATA_DIR "/aiw.uv6"
@@ -192,6 +194,79 @@ START_TEST(inode_findsector_valid_large_files){
 }
 END_TEST
 
+START_TEST(inode_iter_walk){
+	start_test_print;
+
+	ck_assert_invalid_arg(inode_iter_init(NULL, NON_NULL));
+	ck_assert_invalid_arg(inode_iter_next(NULL, NON_NULL, NON_NULL));
+
+	struct unix_filesystem fs = {0};
+	ck_assert_err_none(mountv6(AIW_DISK, &fs));
+
+	// same inodes, in the same order, as inode_read() on every inode number
+	struct inode_iter it;
+	ck_assert_err_none(inode_iter_init(&fs, &it));
+	uint16_t inr = 0;
+	struct inode in = {0}, expected = {0};
+	uint16_t next = ROOT_INUMBER;
+	int found = 0;
+	while(inode_iter_next(&it, &inr, &in) == 1){
+		for(; next < inr; ++next){
+			ck_assert_int_eq(inode_read(&fs, next, &expected), ERR_UNALLOCATED_INODE);
+		}
+		ck_assert_err_none(inode_read(&fs, inr, &expected));
+		ck_assert_inode_eq(in, expected);
+		next = inr + 1;
+		++found;
+	}
+	ck_assert_int_eq(inode_iter_next(&it, &inr, &in), 0);
+	for(; next < fs.s.s_isize * INODES_PER_SECTOR; ++next){
+		ck_assert_int_eq(inode_read(&fs, next, &expected), ERR_UNALLOCATED_INODE);
+	}
+	ck_assert(found > 5);
+
+	ck_assert_err_none(umountv6(&fs));
+	end_test_print;
+}
+END_TEST
+
+START_TEST(inode_map_range_runs){
+	start_test_print;
+
+	ck_assert_invalid_arg(inode_map_range(NULL, NON_NULL, 0, 1, NON_NULL, 1));
+	ck_assert_invalid_arg(inode_map_range(NON_NULL, NULL, 0, 1, NON_NULL, 1));
+	ck_assert_invalid_arg(inode_map_range(NON_NULL, NON_NULL, 0, 1, NULL, 1));
+
+	struct unix_filesystem fs = {0};
+	ck_assert_err_none(mountv6(AIW_DISK, &fs));
+
+	struct inode in = {0};
+	ck_assert_err_none(inode_read(&fs, 5, &in));
+
+	// 34 sectors: 71-78, then 80-105
+	struct inode_extent runs[4];
+	ck_assert_int_eq(inode_map_range(&fs, &in, 0, 1000, runs, 4), 2);
+	ck_assert_int_eq(runs[0].file_off, 0);
+	ck_assert_int_eq(runs[0].sector, 71);
+	ck_assert_int_eq(runs[0].count, 8);
+	ck_assert_int_eq(runs[1].file_off, 8);
+	ck_assert_int_eq(runs[1].sector, 80);
+	ck_assert_int_eq(runs[1].count, 26);
+
+	ck_assert_int_eq(inode_map_range(&fs, &in, 0, 34, runs, 1), 1);
+	ck_assert_int_eq(runs[0].count, 8);
+	ck_assert_int_eq(inode_map_range(&fs, &in, 10, 5, runs, 4), 1);
+	ck_assert_int_eq(runs[0].file_off, 10);
+	ck_assert_int_eq(runs[0].sector, 82);
+	ck_assert_int_eq(runs[0].count, 5);
+	ck_assert_int_eq(inode_map_range(&fs, &in, 34, 5, runs, 4), 0);
+	ck_assert_err(inode_map_range(&fs, &in, 35, 1, runs, 4), ERR_OFFSET_OUT_OF_RANGE);
+
+	ck_assert_err_none(umountv6(&fs));
+	end_test_print;
+}
+END_TEST
+
 START_TEST(inode_write_null_params){
     start_test_print;
 
@@ -227,6 +302,36 @@ START_TEST(inode_write_correct) {
 }
 END_TEST
 
+START_TEST(inode_alloc_near_groups){
+	start_test_print;
+
+	ck_assert_invalid_arg(inode_alloc_near(NULL, ROOT_INUMBER, 0));
+
+	// no image needed: only the bitmaps are used; 4 groups of 2048 inodes
+	struct unix_filesystem u = {0};
+	u.ibm = bm_alloc(1, 8191);
+	u.fbm = bm_alloc(100, 100 + 4 * MOUNTV6_GROUP_SECTORS - 1);
+	ck_assert_ptr_nonnull(u.ibm);
+	ck_assert_ptr_nonnull(u.fbm);
+	ck_assert_int_eq(mountv6_ngroups(&u), 4);
+	ck_assert_int_eq(mountv6_sector_group(&u, 100 + MOUNTV6_GROUP_SECTORS), 1);
+	ck_assert_int_eq(mountv6_group_first_sector(&u, 3), 100 + 3 * MOUNTV6_GROUP_SECTORS);
+
+	// files go to the group of their parent...
+	ck_assert_int_eq(mountv6_inode_group(&u, 2050), 1);
+	ck_assert_int_eq(inode_alloc_near(&u, 2050, IREAD), 2049);
+	ck_assert_int_eq(inode_alloc_near(&u, 2050, IREAD), 2050);
+	// ... directories to the emptiest group
+	ck_assert_int_eq(inode_alloc_near(&u, 2050, IFDIR), 1);
+	ck_assert_int_eq(inode_alloc_near(&u, 1, IFDIR), 2 * 2048 + 1);
+
+	free(u.ibm);
+	free(u.fbm);
+
+	end_test_print;
+}
+END_TEST
+
 Suite* inode_test_suite()
 {
 	Suite* s = suite_create("Tests for inode layer");
@@ -237,6 +342,7 @@ Suite* inode_test_suite()
 	Add_Test(s,  inode_read_valid);
 
 	Add_Test(s,  inode_scan_print_null_param);
+	Add_Test(s,  inode_iter_walk);
 
 	Add_Test(s,  inode_findsector_null_param);
 	Add_Test(s,  inode_findsector_out_of_range);
@@ -244,8 +350,10 @@ Suite* inode_test_suite()
 	Add_Test(s,  inode_findsector_too_large);
 	Add_Test(s,  inode_findsector_valid);
 	Add_Test(s,  inode_findsector_valid_large_files);
+	Add_Test(s,  inode_map_range_runs);
     Add_Test(s,  inode_write_null_params);
     Add_Test(s,  inode_write_correct);
+	Add_Test(s,  inode_alloc_near_groups);
 
 	return s;
 }
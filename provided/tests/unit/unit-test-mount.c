@@ -3,9 +3,13 @@
 
 #include "error.h"
 #include "mount.h"
+#include "sector.h"
+#include "inode.h"
 
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include <stdlib.h>
 
 #define SIMPLE_DISK DATA_DIR "/simple.uv6"
 #define FIRST_DISK  DATA_DIR "/first.uv6"
@@ -188,6 +192,401 @@ START_TEST(bitmaps_correct_first) {
 }
 END_TEST
 
+START_TEST(mount_mmap_read_only) {
+    start_test_print;
+
+    struct unix_filesystem u;
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_MMAP | MOUNTV6_RDONLY;
+    ck_assert_err_none(mountv6_opt(SIMPLE_DISK, &u, &opts));
+    ck_assert_ptr_nonnull(u.dev->mem);
+    ck_assert_ptr_null(u.cache);
+    ck_assert_int_eq(u.s.s_block_start, 34);
+    ck_assert_int_eq(bm_get(u.ibm, 3), 1);
+    ck_assert_int_eq(bm_get(u.ibm, 4), 0);
+
+    uint8_t sector[SECTOR_SIZE] = {0};
+    const void* mapped = NULL;
+    ck_assert_err_none(u6fs_sector_get(&u, BOOTBLOCK_SECTOR, sector, &mapped));
+    ck_assert_ptr_eq(mapped, u.dev->mem);
+    ck_assert_int_eq(u6fs_sector_read(&u, u.s.s_fsize, sector), ERR_IO);
+    ck_assert_int_eq(u6fs_sector_write(&u, BOOTBLOCK_SECTOR, sector), ERR_IO);
+
+    ck_assert_err_none(umountv6(&u));
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_async_scan) {
+    start_test_print;
+
+    struct unix_filesystem u, v;
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_ASYNC | MOUNTV6_RDONLY;
+    ck_assert_err_none(mountv6(AIW_DISK, &u));
+    ck_assert_err_none(mountv6_opt(AIW_DISK, &v, &opts));
+
+    // same bitmaps as the synchronous scan
+    ck_assert_int_eq(u.ibm->length, v.ibm->length);
+    ck_assert_mem_eq(u.ibm->bm, v.ibm->bm, u.ibm->length * sizeof(uint64_t));
+    ck_assert_int_eq(u.fbm->length, v.fbm->length);
+    ck_assert_mem_eq(u.fbm->bm, v.fbm->bm, u.fbm->length * sizeof(uint64_t));
+
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_err_none(umountv6(&v));
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_parallel_scan) {
+    start_test_print;
+
+    const char *disks[] = { AIW_DISK, FIRST_DISK };
+    for (size_t i = 0; i < sizeof(disks) / sizeof(disks[0]); ++i) {
+        struct unix_filesystem u, v;
+        struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+        opts.flags = MOUNTV6_PARALLEL | MOUNTV6_RDONLY;
+        ck_assert_err_none(mountv6(disks[i], &u));
+        ck_assert_err_none(mountv6_opt(disks[i], &v, &opts));
+
+        // same bitmaps and counters as the sequential scan
+        ck_assert_mem_eq(u.ibm->bm, v.ibm->bm, u.ibm->length * sizeof(uint64_t));
+        ck_assert_mem_eq(u.fbm->bm, v.fbm->bm, u.fbm->length * sizeof(uint64_t));
+        ck_assert_int_eq(bm_count_free(u.ibm), bm_count_free(v.ibm));
+        ck_assert_int_eq(bm_count_free(u.fbm), bm_count_free(v.fbm));
+        ck_assert(v.bitmaps_ns > 0);
+
+        ck_assert_err_none(umountv6(&u));
+        ck_assert_err_none(umountv6(&v));
+    }
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_ram_disk) {
+    start_test_print;
+
+    struct unix_filesystem u, v;
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_RAM | MOUNTV6_RDONLY;
+    ck_assert_err_none(mountv6(FIRST_DISK, &u));
+    ck_assert_err_none(mountv6_opt(FIRST_DISK, &v, &opts));
+    ck_assert_ptr_nonnull(v.dev->mem);
+    ck_assert_ptr_null(v.cache);
+    ck_assert_int_eq(blockdev_size(v.dev), v.s.s_fsize);
+    ck_assert_mem_eq(u.fbm->bm, v.fbm->bm, u.fbm->length * sizeof(uint64_t));
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_err_none(umountv6(&v));
+
+    // any device can be mounted; a blank one has no boot sector
+    ck_assert_invalid_arg(mountv6_dev(NULL, &u, &opts));
+    ck_assert_err(mountv6_dev(blockdev_ram(-1, 16, 0), &u, &opts), ERR_BAD_BOOT_SECTOR);
+    ck_assert_ptr_null(u.dev);
+
+    end_test_print;
+}
+END_TEST
+
+/**
+ * @brief read the superblock of an image, past any mount
+ */
+static struct superblock raw_superblock(const char *filename){
+    struct superblock sb = {0};
+    FILE *f = fopen(filename, "rb");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_err_none(sector_read(f, SUPERBLOCK_SECTOR, &sb));
+    fclose(f);
+    return sb;
+}
+
+START_TEST(mount_persistent_bitmaps) {
+    start_test_print;
+
+    const char *dump = DATA_DIR "/dump.mount_persistent_bitmaps.uv6";
+    create_dump_fs(dump, FIRST_DISK);
+
+    // no write, no change: the image is not marked clean
+    struct unix_filesystem u;
+    ck_assert_err_none(mountv6(dump, &u));
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_int_eq(raw_superblock(dump).s_fmod, 0);
+
+    // a write: the bitmaps are saved by umountv6()
+    ck_assert_err_none(mountv6(dump, &u));
+    const int inr = inode_alloc(&u);
+    ck_assert(inr > 0);
+    struct inode in = {0};
+    in.i_mode = IALLOC;
+    ck_assert_err_none(inode_write(&u, (uint16_t) inr, &in));
+    uint64_t ibm[64], fbm[64];
+    ck_assert(u.ibm->length <= 64 && u.fbm->length <= 64);
+    memcpy(ibm, u.ibm->bm, u.ibm->length * sizeof(uint64_t));
+    memcpy(fbm, u.fbm->bm, u.fbm->length * sizeof(uint64_t));
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_int_eq(raw_superblock(dump).s_fmod, MOUNTV6_FMOD_CLEAN);
+
+    // loaded back as they were; the first write marks the filesystem dirty
+    ck_assert_err_none(mountv6(dump, &u));
+    ck_assert_mem_eq(u.ibm->bm, ibm, u.ibm->length * sizeof(uint64_t));
+    ck_assert_mem_eq(u.fbm->bm, fbm, u.fbm->length * sizeof(uint64_t));
+    ck_assert_int_eq(bm_count_free(u.ibm), bm_count_free_range(u.ibm, u.ibm->min, u.ibm->max));
+    ck_assert_err_none(inode_write(&u, (uint16_t) inr, &in));
+    ck_assert_int_eq(raw_superblock(dump).s_fmod, 1);
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_int_eq(raw_superblock(dump).s_fmod, MOUNTV6_FMOD_CLEAN);
+
+    // loaded, not rebuilt: a bit set on disk only is seen
+    struct superblock sb = raw_superblock(dump);
+    FILE *f = fopen(dump, "rb+");
+    ck_assert_ptr_nonnull(f);
+    uint8_t sector[SECTOR_SIZE];
+    ck_assert_err_none(sector_read(f, sb.s_fbm_start, sector));
+    sector[(1000 - 68) / 8] |= (uint8_t) (1 << ((1000 - 68) % 8));
+    ck_assert_err_none(sector_write(f, sb.s_fbm_start, sector));
+    fclose(f);
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_RDONLY;
+    ck_assert_err_none(mountv6_opt(dump, &u, &opts));
+    ck_assert_int_eq(bm_get(u.fbm, 1000), 1);
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_int_eq(raw_superblock(dump).s_fmod, MOUNTV6_FMOD_CLEAN);
+
+    remove(dump);
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_dirty_marker_first) {
+    start_test_print;
+
+    const char *dump = DATA_DIR "/dump.mount_dirty_marker_first.uv6";
+    // a single slot, then enough to keep the superblock cached
+    const size_t cache_sizes[] = { SECTOR_SIZE, CACHE_DEFAULT_SIZE };
+    for (size_t i = 0; i < sizeof(cache_sizes) / sizeof(cache_sizes[0]); ++i) {
+        ck_assert_err_none(mountv6_mkfs(dump, 1024, 256));
+        struct unix_filesystem u;
+        struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+        opts.cache_size = cache_sizes[i];
+        opts.icache_size = 0;
+        opts.flags = MOUNTV6_WRITEBACK;
+        ck_assert_err_none(mountv6_opt(dump, &u, &opts));
+
+        // the first write marks the image dirty on disk, not only in the cache
+        const int inr = inode_alloc(&u);
+        ck_assert(inr > 0);
+        struct inode in = {0};
+        in.i_mode = IALLOC;
+        ck_assert_err_none(inode_write(&u, (uint16_t) inr, &in));
+        ck_assert_int_eq(raw_superblock(dump).s_fmod, 1);
+        struct superblock sb;
+        ck_assert_err_none(u6fs_sector_read(&u, SUPERBLOCK_SECTOR, &sb));
+        ck_assert_int_eq(sb.s_fmod, 1);
+
+        ck_assert_err_none(umountv6(&u));
+        ck_assert_int_eq(raw_superblock(dump).s_fmod, MOUNTV6_FMOD_CLEAN);
+    }
+    remove(dump);
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_unreadable_indirect) {
+    start_test_print;
+
+    const char *dump = DATA_DIR "/dump.mount_unreadable_indirect.uv6";
+    create_dump_fs(dump, FIRST_DISK);
+
+    // a large file whose first indirect sector lies past the end of the disk
+    struct unix_filesystem u;
+    ck_assert_err_none(mountv6(dump, &u));
+    const int inr = inode_alloc(&u);
+    ck_assert(inr > 0);
+    struct inode in = {0};
+    in.i_mode = IALLOC;
+    ck_assert_err_none(inode_setsize(&in, 300 * SECTOR_SIZE));
+    in.i_addr[0] = 5000;
+    in.i_addr[1] = 900;
+    ck_assert_err_none(inode_write(&u, (uint16_t) inr, &in));
+    ck_assert_err_none(umountv6(&u));
+
+    // not clean: every mount rebuilds the bitmaps, and skips that sector
+    struct superblock sb = raw_superblock(dump);
+    sb.s_fmod = 0;
+    FILE *f = fopen(dump, "rb+");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_err_none(sector_write(f, SUPERBLOCK_SECTOR, &sb));
+    fclose(f);
+
+    struct unix_filesystem v;
+    ck_assert_err_none(mountv6(dump, &u));
+    ck_assert_int_eq(bm_get(u.ibm, (uint64_t) inr), 1);
+    ck_assert_int_eq(bm_get(u.fbm, 900), 1);
+    const int flags[] = { MOUNTV6_ASYNC, MOUNTV6_PARALLEL };
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+        struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+        opts.flags = flags[i] | MOUNTV6_RDONLY;
+        ck_assert_err_none(mountv6_opt(dump, &v, &opts));
+        ck_assert_mem_eq(u.ibm->bm, v.ibm->bm, u.ibm->length * sizeof(uint64_t));
+        ck_assert_mem_eq(u.fbm->bm, v.fbm->bm, u.fbm->length * sizeof(uint64_t));
+        ck_assert_err_none(umountv6(&v));
+    }
+    ck_assert_err_none(umountv6(&u));
+    remove(dump);
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_bad_bitmap_sectors) {
+    start_test_print;
+
+    const char *dump = DATA_DIR "/dump.mount_bad_bitmap_sectors.uv6";
+    // mkfs puts the fbm in sector 2, the ibm in sector 3 and the inodes from sector 4 on
+    for (int overlap_fbm = 0; overlap_fbm <= 1; ++overlap_fbm) {
+        ck_assert_err_none(mountv6_mkfs(dump, 1024, 256));
+        struct superblock sb = raw_superblock(dump);
+        ck_assert_int_eq(sb.s_inode_start, 4);
+        if (overlap_fbm) {
+            sb.s_ibm_start = sb.s_fbm_start;
+        } else {
+            sb.s_ibmsize = 2; // into the inode table
+        }
+        FILE *f = fopen(dump, "rb+");
+        ck_assert_ptr_nonnull(f);
+        ck_assert_err_none(sector_write(f, SUPERBLOCK_SECTOR, &sb));
+        fclose(f);
+
+        // the bitmaps are rebuilt, and not saved over those sectors
+        struct unix_filesystem u;
+        ck_assert_err_none(mountv6(dump, &u));
+        ck_assert_int_eq(bm_count_free(u.ibm), 256 - 1);
+        const int inr = inode_alloc(&u);
+        ck_assert_int_eq(inr, ROOT_INUMBER + 1);
+        struct inode in = {0};
+        in.i_mode = IALLOC;
+        ck_assert_err_none(inode_write(&u, (uint16_t) inr, &in));
+        ck_assert_err_none(umountv6(&u));
+        ck_assert_int_eq(raw_superblock(dump).s_fmod, 1);
+
+        ck_assert_err_none(mountv6(dump, &u));
+        ck_assert_err_none(inode_read(&u, ROOT_INUMBER, &in));
+        ck_assert_int_eq(in.i_mode & (IALLOC | IFMT), IALLOC | IFDIR);
+        ck_assert_err_none(inode_read(&u, (uint16_t) inr, &in));
+        ck_assert_int_eq(in.i_mode, IALLOC);
+        ck_assert_int_eq(bm_get(u.ibm, (uint64_t) inr), 1);
+        ck_assert_err_none(umountv6(&u));
+    }
+    remove(dump);
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_lazy_bitmaps) {
+    start_test_print;
+
+    ck_assert_invalid_arg(mountv6_bitmaps(NULL));
+    create_dump_fs(DATA_DIR "/dump.mount_lazy_bitmaps.uv6", AIW_DISK);
+
+    struct unix_filesystem u, v;
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_LAZY;
+    ck_assert_err_none(mountv6(AIW_DISK, &v));
+    ck_assert_err_none(mountv6_opt(DATA_DIR "/dump.mount_lazy_bitmaps.uv6", &u, &opts));
+
+    // only the boot sector and the superblock were read
+    ck_assert_ptr_null(u.ibm);
+    ck_assert_ptr_null(u.fbm);
+    ck_assert_int_eq(u.cache->stats.hits + u.cache->stats.misses, 0);
+    struct inode in;
+    ck_assert_err_none(inode_read(&u, 5, &in));
+    ck_assert_ptr_null(u.ibm);
+
+    // the first allocation builds them, as an eager mount does
+    const int inr = inode_alloc(&u);
+    ck_assert_ptr_nonnull(u.ibm);
+    ck_assert_ptr_nonnull(u.fbm);
+    ck_assert_int_eq(inr, bm_find_next(v.ibm));
+    bm_clear(u.ibm, (uint64_t) inr);
+    ck_assert_mem_eq(u.ibm->bm, v.ibm->bm, u.ibm->length * sizeof(uint64_t));
+    ck_assert_mem_eq(u.fbm->bm, v.fbm->bm, u.fbm->length * sizeof(uint64_t));
+    ck_assert_err_none(mountv6_bitmaps(&u));
+
+    ck_assert_err_none(umountv6(&u));
+    ck_assert_err_none(umountv6(&v));
+    remove(DATA_DIR "/dump.mount_lazy_bitmaps.uv6");
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(mount_mkfs) {
+    start_test_print;
+
+    const char *dump = DATA_DIR "/dump.mount_mkfs.uv6";
+    ck_assert_invalid_arg(mountv6_mkfs(NULL, 1024, 256));
+    ck_assert_err(mountv6_mkfs(dump, 1024, 0), ERR_BAD_PARAMETER);
+    ck_assert_err(mountv6_mkfs(dump, 16, 256), ERR_BAD_PARAMETER);
+
+    ck_assert_err_none(mountv6_mkfs(dump, 1024, 256));
+    const struct superblock sb = raw_superblock(dump);
+    ck_assert_int_eq(sb.s_fsize, 1024);
+    ck_assert_int_eq(sb.s_isize, 256 / INODES_PER_SECTOR);
+    ck_assert_int_eq(sb.s_fbm_start, 2);
+    ck_assert_int_eq(sb.s_ibm_start, 3);
+    ck_assert_int_eq(sb.s_inode_start, 4);
+    ck_assert_int_eq(sb.s_block_start, 4 + 256 / INODES_PER_SECTOR);
+    ck_assert_int_eq(sb.s_fmod, MOUNTV6_FMOD_CLEAN);
+
+    // the bitmaps are loaded: only the root inode is used
+    struct unix_filesystem u;
+    ck_assert_err_none(mountv6(dump, &u));
+    ck_assert_int_eq(bm_count_free(u.ibm), 256 - 1);
+    ck_assert_int_eq(bm_count_free(u.fbm), 1024 - sb.s_block_start + 1);
+    struct inode in;
+    ck_assert_err_none(inode_read(&u, ROOT_INUMBER, &in));
+    ck_assert_int_eq(in.i_mode & (IALLOC | IFMT), IALLOC | IFDIR);
+    ck_assert_int_eq(inode_getsize(&in), 0);
+    ck_assert_int_eq(inode_alloc(&u), ROOT_INUMBER + 1);
+    ck_assert_err_none(umountv6(&u));
+
+    // the largest inode table: every inode number fits a uint16_t
+    ck_assert_err_none(mountv6_mkfs(dump, 8192, UINT16_MAX));
+    ck_assert_int_eq(raw_superblock(dump).s_isize, UINT16_MAX / INODES_PER_SECTOR);
+    ck_assert_err_none(mountv6(dump, &u));
+    ck_assert(u.ibm->max <= UINT16_MAX);
+    ck_assert_int_eq(bm_count_free(u.ibm), u.ibm->max - ROOT_INUMBER);
+    ck_assert_err_none(umountv6(&u));
+
+    // and match the ones rebuilt from the inodes
+    struct mountv6_options opts = MOUNTV6_DEFAULT_OPTIONS;
+    opts.flags = MOUNTV6_RDONLY;
+    ck_assert_err_none(mountv6_mkfs(dump, 1024, 256));
+    ck_assert_err_none(mountv6_opt(dump, &u, &opts));
+    uint64_t ibm[64], fbm[64];
+    ck_assert(u.ibm->length <= 64 && u.fbm->length <= 64);
+    memcpy(ibm, u.ibm->bm, u.ibm->length * sizeof(uint64_t));
+    memcpy(fbm, u.fbm->bm, u.fbm->length * sizeof(uint64_t));
+    free(u.ibm);
+    free(u.fbm);
+    u.ibm = u.fbm = NULL;
+    u.s.s_fmod = 0;
+    ck_assert_err_none(mountv6_bitmaps(&u));
+    ck_assert_mem_eq(u.ibm->bm, ibm, u.ibm->length * sizeof(uint64_t));
+    ck_assert_mem_eq(u.fbm->bm, fbm, u.fbm->length * sizeof(uint64_t));
+    ck_assert_err_none(umountv6(&u));
+
+    remove(dump);
+
+    end_test_print;
+}
+END_TEST
+
 Suite* mount_test_suite(){
 	Suite* s = suite_create("Tests for disk (un)mount");
 
@@ -202,6 +601,16 @@ Suite* mount_test_suite(){
     Add_Test(s, bitmaps_correct_simple);
     Add_Test(s, bitmaps_correct_aiw);
     Add_Test(s, bitmaps_correct_first);
+    Add_Test(s, mount_mmap_read_only);
+    Add_Test(s, mount_async_scan);
+    Add_Test(s, mount_parallel_scan);
+    Add_Test(s, mount_unreadable_indirect);
+    Add_Test(s, mount_ram_disk);
+    Add_Test(s, mount_persistent_bitmaps);
+    Add_Test(s, mount_dirty_marker_first);
+    Add_Test(s, mount_bad_bitmap_sectors);
+    Add_Test(s, mount_lazy_bitmaps);
+    Add_Test(s, mount_mkfs);
 
 	return s;
 }
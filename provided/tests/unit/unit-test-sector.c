@@ -90,6 +90,86 @@ START_TEST(sector_write_correct_offset) {
 }
 END_TEST
 
+START_TEST(sector_pread_pwrite) {
+    start_test_print;
+
+    const char empty_array[4096] = {0};
+    char data[SECTOR_SIZE] = {0};
+    char read[SECTOR_SIZE] = {0};
+    memset(data, 7, SECTOR_SIZE);
+
+    FILE *file = fopen(TEMP_FILE, "w+");
+    ck_assert_msg(file, "Could not create temporary file at " TEMP_FILE);
+    ck_assert_msg(fwrite(empty_array, 4096, 1, file) == 1, "Could not write to temporary file " TEMP_FILE);
+    ck_assert(fflush(file) == 0);
+
+    ck_assert_invalid_arg(sector_pread(-1, 0, read));
+    ck_assert_invalid_arg(sector_pread(fileno(file), 0, NULL));
+    ck_assert_invalid_arg(sector_pwrite(fileno(file), 0, NULL));
+
+    // positional: the stdio cursor is neither used nor moved
+    const long cursor = ftell(file);
+    ck_assert_err_none(sector_pwrite(fileno(file), 3, data));
+    ck_assert_err_none(sector_pread(fileno(file), 3, read));
+    ck_assert_mem_eq(data, read, SECTOR_SIZE);
+    ck_assert_int_eq(ftell(file), cursor);
+
+    ck_assert_int_eq(sector_pread(fileno(file), 8, read), ERR_IO);
+
+    fclose(file);
+    remove(TEMP_FILE);
+
+    end_test_print;
+}
+END_TEST
+
+START_TEST(sector_range_and_scatter) {
+    start_test_print;
+
+    const char empty_array[4096] = {0};
+    uint8_t data[4 * SECTOR_SIZE] = {0};
+    uint8_t read[4 * SECTOR_SIZE] = {0};
+    for(int i = 0; i < 4; ++i){
+        memset(data + i * SECTOR_SIZE, i + 1, SECTOR_SIZE);
+    }
+
+    FILE *file = fopen(TEMP_FILE, "w+");
+    ck_assert_msg(file, "Could not create temporary file at " TEMP_FILE);
+    ck_assert_msg(fwrite(empty_array, 4096, 1, file) == 1, "Could not write to temporary file " TEMP_FILE);
+    ck_assert(fflush(file) == 0);
+    const int fd = fileno(file);
+
+    ck_assert_invalid_arg(sector_pread_range(-1, 0, 1, read));
+    ck_assert_invalid_arg(sector_pwrite_range(fd, 0, 1, NULL));
+    ck_assert_invalid_arg(sector_preadv(fd, NULL, NULL, 1));
+    ck_assert_err_none(sector_preadv(fd, NULL, NULL, 0));
+
+    ck_assert_err_none(sector_pwrite_range(fd, 2, 4, data));
+    ck_assert_err_none(sector_pread_range(fd, 2, 4, read));
+    ck_assert_mem_eq(data, read, sizeof(data));
+    ck_assert_int_eq(sector_pread_range(fd, 6, 4, read), ERR_IO);
+
+    // two runs (5,6,7 and 2), written and read back in one call each
+    const uint32_t sectors[] = {5, 6, 7, 2};
+    const void *wbufs[] = {data + 3 * SECTOR_SIZE, data + 2 * SECTOR_SIZE, data + SECTOR_SIZE, data};
+    void *rbufs[] = {read, read + SECTOR_SIZE, read + 2 * SECTOR_SIZE, read + 3 * SECTOR_SIZE};
+    ck_assert_err_none(sector_pwritev(fd, sectors, wbufs, 4));
+    memset(read, 0, sizeof(read));
+    ck_assert_err_none(sector_preadv(fd, sectors, rbufs, 4));
+    for(int i = 0; i < 4; ++i){
+        ck_assert_mem_eq(wbufs[i], rbufs[i], SECTOR_SIZE);
+    }
+
+    const uint32_t beyond[] = {7, 8};
+    ck_assert_int_eq(sector_preadv(fd, beyond, rbufs, 2), ERR_IO);
+
+    fclose(file);
+    remove(TEMP_FILE);
+
+    end_test_print;
+}
+END_TEST
+
 Suite* sector_test_suite(){
 	Suite* s = suite_create("Tests for sector layer");
 
@@ -100,6 +180,8 @@ Suite* sector_test_suite(){
     Add_Case(s, tc2, "sector_write");
     Add_Test(s,  sector_write_null_params);
     Add_Test(s,  sector_write_correct_offset);
+    Add_Test(s,  sector_pread_pwrite);
+    Add_Test(s,  sector_range_and_scatter);
     
 	return s;
 }